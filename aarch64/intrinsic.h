@@ -320,5 +320,8 @@ static ALWAYS_INLINE NO_RETURN void arch_stop_cpu()
      compiler_fence())
 
 void delay_us(u64 n);
+// zero/copy a whole page. Both must be page aligned. See `page.S`.
+void clear_page(void *page);
+void copy_page(void *dest, const void *src);
 u64 psci_cpu_on(u64 cpuid, u64 ep);
 void smp_init();
\ No newline at end of file
@@ -36,6 +36,7 @@ typedef unsigned long long u64;
 #define PTE_KERNEL_DATA (PTE_KERNEL | PTE_NORMAL | PTE_BLOCK)
 #define PTE_KERNEL_DEVICE (PTE_KERNEL | PTE_DEVICE | PTE_BLOCK)
 #define PTE_USER_DATA (PTE_USER | PTE_NORMAL | PTE_PAGE)
+#define PTE_KERNEL_PAGE (PTE_KERNEL | PTE_NORMAL | PTE_PAGE)
 
 #define N_PTE_PER_TABLE 512
 
@@ -46,3 +46,87 @@ static INLINE void bitmap_clear(BitmapCell *bitmap, usize index)
     BITMAP_PARSE_INDEX(index, idx, offset);
     bitmap[idx] &= ~BIT(offset);
 }
+
+// bits [from, to) of a cell, for 0 <= from < to <= BITMAP_BITS_PER_CELL.
+static INLINE BitmapCell _bitmap_mask(usize from, usize to)
+{
+    BitmapCell high = to == BITMAP_BITS_PER_CELL ? ~(BitmapCell)0 : BIT(to) - 1;
+    return high & ~(BIT(from) - 1);
+}
+
+// find the first bit at or after `start` whose value is `value` in a bitmap
+// with `size` bits. Return `size` if there is none.
+static INLINE usize _bitmap_find_next(BitmapCell *bitmap, usize size,
+                                      usize start, bool value)
+{
+    if (start >= size)
+        return size;
+    usize idx, offset;
+    BITMAP_PARSE_INDEX(start, idx, offset);
+    // look for ones: flip the cells when looking for zeros, and drop the
+    // bits before `start`.
+    BitmapCell flip = value ? 0 : ~(BitmapCell)0;
+    BitmapCell cell = (bitmap[idx] ^ flip) & ~(BIT(offset) - 1);
+    while (cell == 0) {
+        if (++idx >= BITMAP_TO_NUM_CELLS(size))
+            return size;
+        cell = bitmap[idx] ^ flip;
+    }
+    return MIN(idx * BITMAP_BITS_PER_CELL + __builtin_ctzll(cell), size);
+}
+
+// return the index of the first 0 bit at or after `start`, or `size` if all
+// bits from `start` on are set.
+static INLINE usize bitmap_find_next_zero(BitmapCell *bitmap, usize size,
+                                          usize start)
+{
+    return _bitmap_find_next(bitmap, size, start, false);
+}
+
+static INLINE usize bitmap_find_first_zero(BitmapCell *bitmap, usize size)
+{
+    return _bitmap_find_next(bitmap, size, 0, false);
+}
+
+// return the index of the first 1 bit at or after `start`, or `size`.
+static INLINE usize bitmap_find_next_set(BitmapCell *bitmap, usize size,
+                                         usize start)
+{
+    return _bitmap_find_next(bitmap, size, start, true);
+}
+
+// set the `n` bits from `start` on to 1.
+static INLINE void bitmap_set_range(BitmapCell *bitmap, usize start, usize n)
+{
+    for (usize end = start + n; start < end;) {
+        usize idx, offset;
+        BITMAP_PARSE_INDEX(start, idx, offset);
+        usize len = MIN(end - start, BITMAP_BITS_PER_CELL - offset);
+        bitmap[idx] |= _bitmap_mask(offset, offset + len);
+        start += len;
+    }
+}
+
+// set the `n` bits from `start` on to 0.
+static INLINE void bitmap_clear_range(BitmapCell *bitmap, usize start, usize n)
+{
+    for (usize end = start + n; start < end;) {
+        usize idx, offset;
+        BITMAP_PARSE_INDEX(start, idx, offset);
+        usize len = MIN(end - start, BITMAP_BITS_PER_CELL - offset);
+        bitmap[idx] &= ~_bitmap_mask(offset, offset + len);
+        start += len;
+    }
+}
+
+// return the number of 1 bits in a bitmap with `size` bits.
+static INLINE usize bitmap_count(BitmapCell *bitmap, usize size)
+{
+    usize count = 0, cells = size / BITMAP_BITS_PER_CELL;
+    for (usize i = 0; i < cells; ++i)
+        count += __builtin_popcountll(bitmap[i]);
+    if (size % BITMAP_BITS_PER_CELL)
+        count += __builtin_popcountll(bitmap[cells] &
+                                      _bitmap_mask(0, size % BITMAP_BITS_PER_CELL));
+    return count;
+}
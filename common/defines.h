@@ -42,7 +42,10 @@ typedef u64 usize;
 
 #define BIT(i) (1ull << (i))
 
+#define CACHE_LINE_SIZE 64
+
 #define NO_BSS __attribute__((section(".data")))
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE_SIZE)))
 #define NO_RETURN __attribute__((noreturn))
 #define INLINE inline __attribute__((unused))
 #define ALWAYS_INLINE inline __attribute__((unused, always_inline))
@@ -0,0 +1,133 @@
+#include <common/hashtable.h>
+#include <kernel/mem.h>
+
+static INLINE struct hash_bucket *_bucket_of(struct hash_buckets *bs, u64 key)
+{
+    // Fibonacci hashing: the top bits of the product depend on all key bits.
+    return &bs->b[key * 0x9E3779B97F4A7C15ull >> (64 - bs->bits)];
+}
+
+static struct hash_buckets *_alloc_buckets(usize bits)
+{
+    usize n = 1ull << bits;
+    struct hash_buckets *bs =
+            kalloc(sizeof(struct hash_buckets) + n * sizeof(struct hash_bucket));
+    if (bs == NULL)
+        return NULL;
+    bs->bits = bits;
+    for (usize i = 0; i < n; ++i) {
+        init_spinlock(&bs->b[i].lock);
+        bs->b[i].head = NULL;
+    }
+    return bs;
+}
+
+static void _free_buckets(RcuHead *rcu)
+{
+    kfree(container_of(rcu, struct hash_buckets, rcu));
+}
+
+void init_hashtable(HashTable *ht, usize bits)
+{
+    ASSERT(bits > 0 && bits <= HASHTABLE_MAX_BITS);
+    ht->count = 0;
+    init_rwlock(&ht->resize_lock);
+    ht->buckets = _alloc_buckets(bits);
+    ASSERT(ht->buckets != NULL);
+}
+
+static INLINE bool _overloaded(HashTable *ht)
+{
+    usize bits = ht->buckets->bits;
+    return bits < HASHTABLE_MAX_BITS &&
+           __atomic_load_n(&ht->count, __ATOMIC_RELAXED) > (2ull << bits);
+}
+
+static void _grow(HashTable *ht)
+{
+    acquire_write_lock(&ht->resize_lock);
+    // another insertion may have grown the table already.
+    if (!_overloaded(ht)) {
+        release_write_lock(&ht->resize_lock);
+        return;
+    }
+    struct hash_buckets *old = ht->buckets;
+    usize n = 1ull << old->bits;
+    struct hash_buckets *bs = _alloc_buckets(old->bits + 1);
+    // without memory, the table just stays crowded.
+    if (bs != NULL) {
+        // nobody else is in the table, so the buckets need no locking.
+        // Lock-free readers may follow a moved node into its new bucket
+        // and miss a node, but never leave the nodes of the table.
+        for (usize i = 0; i < n; ++i) {
+            while (old->b[i].head != NULL) {
+                HashNode *node = old->b[i].head;
+                old->b[i].head = node->next;
+                auto b = _bucket_of(bs, node->key);
+                node->next = b->head;
+                rcu_assign_pointer(b->head, node);
+            }
+        }
+        rcu_assign_pointer(ht->buckets, bs);
+        call_rcu(&old->rcu, _free_buckets);
+    }
+    release_write_lock(&ht->resize_lock);
+}
+
+void hashtable_insert(HashTable *ht, HashNode *node, u64 key)
+{
+    node->key = key;
+    acquire_read_lock(&ht->resize_lock);
+    auto b = _bucket_of(ht->buckets, key);
+    acquire_spinlock(&b->lock);
+    node->next = b->head;
+    rcu_assign_pointer(b->head, node);
+    release_spinlock(&b->lock);
+    __atomic_fetch_add(&ht->count, 1, __ATOMIC_RELAXED);
+    bool grow = _overloaded(ht);
+    release_read_lock(&ht->resize_lock);
+    if (grow)
+        _grow(ht);
+}
+
+void hashtable_remove(HashTable *ht, HashNode *node)
+{
+    acquire_read_lock(&ht->resize_lock);
+    auto b = _bucket_of(ht->buckets, node->key);
+    acquire_spinlock(&b->lock);
+    HashNode **p = &b->head;
+    while (*p != node) {
+        ASSERT(*p != NULL);
+        p = &(*p)->next;
+    }
+    rcu_assign_pointer(*p, node->next);
+    release_spinlock(&b->lock);
+    __atomic_fetch_sub(&ht->count, 1, __ATOMIC_RELAXED);
+    release_read_lock(&ht->resize_lock);
+}
+
+HashNode *hashtable_find(HashTable *ht, u64 key,
+                         bool (*match)(HashNode *, void *), void *arg)
+{
+    acquire_read_lock(&ht->resize_lock);
+    auto b = _bucket_of(ht->buckets, key);
+    acquire_spinlock(&b->lock);
+    HashNode *node = b->head;
+    while (node != NULL &&
+           (node->key != key || (match != NULL && !match(node, arg))))
+        node = node->next;
+    release_spinlock(&b->lock);
+    release_read_lock(&ht->resize_lock);
+    return node;
+}
+
+HashNode *hashtable_find_rcu(HashTable *ht, u64 key,
+                             bool (*match)(HashNode *, void *), void *arg)
+{
+    auto b = _bucket_of(rcu_dereference(ht->buckets), key);
+    HashNode *node = rcu_dereference(b->head);
+    while (node != NULL &&
+           (node->key != key || (match != NULL && !match(node, arg))))
+        node = rcu_dereference(node->next);
+    return node;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <common/defines.h>
+#include <common/rcu.h>
+#include <common/rwlock.h>
+#include <common/spinlock.h>
+
+// a table never grows beyond 2^HASHTABLE_MAX_BITS buckets.
+#define HASHTABLE_MAX_BITS 10
+
+// embed it in the objects to index, like `ListNode`.
+typedef struct hash_node {
+    struct hash_node *next;
+    u64 key;
+} HashNode;
+
+struct hash_bucket {
+    SpinLock lock;
+    HashNode *head;
+};
+
+struct hash_buckets {
+    // frees the array replaced by a resize once no reader can see it.
+    RcuHead rcu;
+    // there are 2^bits buckets.
+    usize bits;
+    struct hash_bucket b[];
+};
+
+/**
+ * Intrusive hash table with a lock per bucket.
+ *
+ * Operations on different buckets run in parallel: each takes `resize_lock`
+ * for reading and the lock of its bucket. Once there are more than two
+ * nodes per bucket on average, an insertion doubles the buckets under
+ * `resize_lock` for writing. The table never shrinks.
+ *
+ * Several nodes may have the same key. `hashtable_find` tells them apart
+ * with a callback.
+ *
+ * Links are published with `rcu_assign_pointer`, so `hashtable_find_rcu`
+ * can walk a bucket without any lock. The caller frees removed nodes
+ * through `call_rcu`.
+ */
+typedef struct {
+    struct hash_buckets *buckets;
+    usize count;
+    RWLock resize_lock;
+} HashTable;
+
+// initialize an empty table with 2^bits buckets.
+void init_hashtable(HashTable *ht, usize bits);
+void hashtable_insert(HashTable *ht, HashNode *node, u64 key);
+// `node` must be in the table. It keeps its link, so a lock-free reader
+// standing on it can still move on.
+void hashtable_remove(HashTable *ht, HashNode *node);
+/**
+ * Return the first node with `key` for which `match(node, arg)` is true, or
+ * NULL. A NULL `match` accepts any node with `key`.
+ *
+ * `match` runs with the bucket locked, so it can take a reference to the
+ * object before anyone removes it. It must not use the table itself.
+ */
+WARN_RESULT HashNode *hashtable_find(HashTable *ht, u64 key,
+                                     bool (*match)(HashNode *, void *),
+                                     void *arg);
+/**
+ * Like `hashtable_find`, but takes no lock. Call it between
+ * `rcu_read_lock` and `rcu_read_unlock`.
+ *
+ * `match` runs without the bucket lock and may see a node that is being
+ * removed; it must check that the object is still alive. A node being
+ * inserted or moved by a resize may be missed, so confirm a miss with
+ * `hashtable_find` before acting on it.
+ */
+WARN_RESULT HashNode *hashtable_find_rcu(HashTable *ht, u64 key,
+                                         bool (*match)(HashNode *, void *),
+                                         void *arg);
@@ -71,6 +71,64 @@ QueueNode *fetch_all_from_queue(QueueNode **head)
     return __atomic_exchange_n(head, NULL, __ATOMIC_ACQ_REL);
 }
 
+#define TAG_SHIFT 48
+#define TAG_MASK (~0ull << TAG_SHIFT)
+
+static INLINE QueueNode *_untag(TaggedQueue *queue, u64 head)
+{
+    head &= ~TAG_MASK;
+    return head ? (QueueNode *)(head | queue->high) : NULL;
+}
+
+static INLINE u64 _tag(u64 old, QueueNode *node)
+{
+    return ((old & TAG_MASK) + BIT(TAG_SHIFT)) | ((u64)node & ~TAG_MASK);
+}
+
+void init_tagged_queue(TaggedQueue *queue)
+{
+    queue->head = 0;
+    queue->high = 0;
+}
+
+QueueNode *add_to_tagged_queue(TaggedQueue *queue, QueueNode *node)
+{
+    u64 high = (u64)node & TAG_MASK;
+    if (__atomic_load_n(&queue->high, __ATOMIC_RELAXED) != high)
+        __atomic_store_n(&queue->high, high, __ATOMIC_RELAXED);
+    u64 head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    do
+        node->next = _untag(queue, head);
+    while (!__atomic_compare_exchange_n(&queue->head, &head, _tag(head, node),
+                                        true, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE));
+    return node;
+}
+
+QueueNode *fetch_from_tagged_queue(TaggedQueue *queue)
+{
+    u64 head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    QueueNode *node;
+    // reading `node->next` is safe even if the node is taken by another CPU
+    // right now: the CAS fails because the tag has changed.
+    while ((node = _untag(queue, head)) &&
+           !__atomic_compare_exchange_n(&queue->head, &head,
+                                        _tag(head, node->next), true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        ;
+    return node;
+}
+
+QueueNode *fetch_all_from_tagged_queue(TaggedQueue *queue)
+{
+    u64 head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&queue->head, &head, _tag(head, NULL),
+                                        true, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE))
+        ;
+    return _untag(queue, head);
+}
+
 void queue_init(Queue *x)
 {
     x->begin = x->end = 0;
@@ -64,6 +64,24 @@ QueueNode *fetch_from_queue(QueueNode **head);
 // remove all nodes from the queue and return them as a single list
 QueueNode *fetch_all_from_queue(QueueNode **head);
 
+// Lockfree Queue with ABA protection. `fetch_from_queue` may pop a node that
+// was popped and pushed again by another CPU in the meantime, and install a
+// stale `next`. A TaggedQueue keeps a generation number in the unused high 16
+// bits of the head pointer, so such a CAS fails.
+// All nodes of one TaggedQueue must share the same high 16 address bits.
+typedef struct TaggedQueue {
+    u64 head;
+    // the high 16 bits of node addresses, recorded by the first push.
+    u64 high;
+} TaggedQueue;
+void init_tagged_queue(TaggedQueue *queue);
+// add a node to the queue and return the added node
+QueueNode *add_to_tagged_queue(TaggedQueue *queue, QueueNode *node);
+// remove the last added node from the queue and return it
+QueueNode *fetch_from_tagged_queue(TaggedQueue *queue);
+// remove all nodes from the queue and return them as a single list
+QueueNode *fetch_all_from_tagged_queue(TaggedQueue *queue);
+
 typedef struct Queue {
     ListNode *begin;
     ListNode *end;
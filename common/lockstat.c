@@ -0,0 +1,83 @@
+#include <common/lockstat.h>
+#include <kernel/printk.h>
+
+static struct lockstat lockstat[LOCKSTAT_SLOTS];
+// the sites that found the table full.
+static struct lockstat lockstat_other;
+
+static struct lockstat *_lockstat_find(u64 key)
+{
+    usize h = key * 0x9E3779B97F4A7C15ull >> 55;
+    for (usize i = 0; i < LOCKSTAT_SLOTS; ++i) {
+        auto st = &lockstat[(h + i) % LOCKSTAT_SLOTS];
+        u64 cur = __atomic_load_n(&st->key, __ATOMIC_RELAXED);
+        if (cur == 0 &&
+            __atomic_compare_exchange_n(&st->key, &cur, key, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return st;
+        // a failed CAS has loaded the key that won the slot.
+        if (cur == key)
+            return st;
+    }
+    return &lockstat_other;
+}
+
+struct lockstat *lockstat_acquire(enum lockstat_kind kind, u64 site,
+                                  bool contended, u64 wait)
+{
+    // code addresses are 4-byte aligned, which leaves room for the kind.
+    auto stat = _lockstat_find(site | kind);
+    __atomic_fetch_add(&stat->acquires, 1, __ATOMIC_RELAXED);
+    if (contended) {
+        __atomic_fetch_add(&stat->contended, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stat->wait, wait, __ATOMIC_RELAXED);
+    }
+    return stat;
+}
+
+void lockstat_release(struct lockstat *stat, u64 held)
+{
+    int b = 63 - __builtin_clzll(held | 1);
+    __atomic_fetch_add(&stat->hold[MIN(b, LOCKSTAT_BUCKETS - 1)], 1,
+                       __ATOMIC_RELAXED);
+}
+
+static void _lockstat_print(struct lockstat *st)
+{
+    static const char *kinds[] = { "spin", "sem", "mutex" };
+    u64 key = __atomic_load_n(&st->key, __ATOMIC_RELAXED);
+    printk("%p %s: %llu %llu %llu |", (void *)(key & ~3ull),
+           st == &lockstat_other ? "other" : kinds[key & 3], st->acquires,
+           st->contended, st->wait);
+    for (int b = 0; b < LOCKSTAT_BUCKETS; ++b) {
+        if (st->hold[b])
+            printk(" %d:%llu", b, st->hold[b]);
+    }
+    printk("\n");
+}
+
+void lockstat_dump(usize n)
+{
+    bool printed[LOCKSTAT_SLOTS] = { 0 };
+#if !LOCKSTAT
+    printk("lockstat: built without LOCKSTAT\n");
+#endif
+    printk("site kind: acquires contended wait | log2(hold):count\n");
+    for (usize k = 0; k < n; ++k) {
+        struct lockstat *top = NULL;
+        for (usize i = 0; i < LOCKSTAT_SLOTS; ++i) {
+            auto st = &lockstat[i];
+            if (printed[i] || __atomic_load_n(&st->key, __ATOMIC_RELAXED) == 0)
+                continue;
+            if (top == NULL || st->wait > top->wait ||
+                (st->wait == top->wait && st->acquires > top->acquires))
+                top = st;
+        }
+        if (top == NULL)
+            break;
+        printed[top - lockstat] = true;
+        _lockstat_print(top);
+    }
+    if (lockstat_other.acquires)
+        _lockstat_print(&lockstat_other);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <common/defines.h>
+
+// profile every SpinLock, Semaphore and Mutex. Off by default, since it
+// puts timestamps and shared counters on every acquire and release; build
+// with -DLOCKSTAT=1 to turn it on.
+#ifndef LOCKSTAT
+#define LOCKSTAT 0
+#endif
+
+// number of acquisition sites that can be told apart. Sites beyond that
+// are summed up in one entry.
+#define LOCKSTAT_SLOTS 512
+// hold times are counted in log2 buckets of timer ticks.
+#define LOCKSTAT_BUCKETS 24
+
+enum lockstat_kind {
+    LOCKSTAT_SPINLOCK,
+    LOCKSTAT_SEMAPHORE,
+    LOCKSTAT_MUTEX,
+};
+
+/**
+ * The profile of one acquisition site: all locks of one kind taken at the
+ * same code address. Locks come and go with the objects holding them, but
+ * the sites are fixed, so the table does not fill up with dead locks.
+ *
+ * Holders of different locks may update one entry at once, so all counters
+ * are atomic. Readers may see counters that are slightly out of date.
+ */
+struct lockstat {
+    // the acquisition site with the kind in the low two bits, or 0 if the
+    // slot is free.
+    u64 key;
+    u64 acquires, contended;
+    // timer ticks spent spinning or sleeping for the lock.
+    u64 wait;
+    // hold[i]: number of holds of [2^i, 2^(i + 1)) ticks.
+    u64 hold[LOCKSTAT_BUCKETS];
+};
+
+// account an acquisition at `site`, which waited `wait` ticks if it was
+// contended. Return the entry of the site, which the lock keeps for
+// `lockstat_release`.
+WARN_RESULT struct lockstat *lockstat_acquire(enum lockstat_kind kind, u64 site,
+                                              bool contended, u64 wait);
+// account a hold of `held` ticks. Call before the lock is released.
+void lockstat_release(struct lockstat *stat, u64 held);
+// print the `n` sites with the most waiting time.
+void lockstat_dump(usize n);
@@ -0,0 +1,60 @@
+#include <common/mutex.h>
+#include <kernel/proc.h>
+#include <kernel/sched.h>
+
+void init_mutex(Mutex *mutex)
+{
+    mutex->owner = NULL;
+    init_sem(&mutex->sem, 1);
+#if LOCKSTAT
+    mutex->sem.profile = false;
+    mutex->stat = NULL;
+#endif
+}
+
+bool _acquire_mutex(Mutex *mutex, bool alertable)
+{
+    auto this = thisproc();
+#if LOCKSTAT
+    u64 start = get_timestamp();
+#endif
+    bool contended = false;
+    for (int i = 0; i < MUTEX_SPIN_LIMIT; ++i) {
+        // peek without the lock of `sem` to keep spinning waiters off it.
+        if (__atomic_load_n(&mutex->sem.val, __ATOMIC_RELAXED) > 0 &&
+            get_sem(&mutex->sem))
+            goto acquired;
+        // the owner may be freed right after it releases the lock, but its
+        // memory stays mapped, and a stale state at worst ends the spin.
+        auto owner = __atomic_load_n(&mutex->owner, __ATOMIC_RELAXED);
+        if (owner == NULL || owner == this ||
+            __atomic_load_n(&owner->state, __ATOMIC_RELAXED) != RUNNING)
+            break;
+        arch_yield();
+    }
+    // the fast path failed, so the wait counts as contended.
+    contended = true;
+    _lock_sem(&mutex->sem);
+    if (!_wait_sem(&mutex->sem, alertable))
+        return false;
+acquired:
+    __atomic_store_n(&mutex->owner, this, __ATOMIC_RELAXED);
+#if LOCKSTAT
+    mutex->since = get_timestamp();
+    mutex->stat = lockstat_acquire(LOCKSTAT_MUTEX,
+                                   (u64)__builtin_return_address(0), contended,
+                                   mutex->since - start);
+#else
+    (void)contended;
+#endif
+    return true;
+}
+
+void release_mutex(Mutex *mutex)
+{
+#if LOCKSTAT
+    lockstat_release(mutex->stat, get_timestamp() - mutex->since);
+#endif
+    __atomic_store_n(&mutex->owner, NULL, __ATOMIC_RELAXED);
+    post_sem(&mutex->sem);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <common/sem.h>
+
+struct Proc;
+
+// max rounds a waiter spins before it goes to sleep anyway.
+#define MUTEX_SPIN_LIMIT 1024
+
+/**
+ * Adaptive sleeping lock.
+ *
+ * A waiter spins while the owner is RUNNING on another CPU, since the owner
+ * is then likely to release the lock soon, and a context switch would cost
+ * more than the wait. If the owner sleeps or waits for a CPU, or the spin
+ * takes too long, the waiter sleeps on `sem` like a `SleepLock`.
+ */
+typedef struct {
+    struct Proc *owner;
+    Semaphore sem;
+#if LOCKSTAT
+    struct lockstat *stat;
+    // when the owner took the mutex.
+    u64 since;
+#endif
+} Mutex;
+
+void init_mutex(Mutex *);
+WARN_RESULT bool _acquire_mutex(Mutex *, bool alertable);
+void release_mutex(Mutex *);
+#define acquire_mutex(mutex) _acquire_mutex(mutex, true)
+#define unalertable_acquire_mutex(mutex) ASSERT(_acquire_mutex(mutex, false))
@@ -0,0 +1,27 @@
+#include <aarch64/intrinsic.h>
+#include <common/percpu_counter.h>
+
+void init_percpu_counter(PercpuCounter *counter, isize value)
+{
+    for (int i = 0; i < PERCPU_COUNTER_SLOTS; ++i)
+        counter->slot[i].count = 0;
+    counter->slot[0].count = value;
+}
+
+void percpu_counter_add(PercpuCounter *counter, isize delta)
+{
+    // traps are disabled in the kernel, so nobody else writes this slot
+    // between the load and the store. The atomics only keep readers from
+    // seeing a torn value.
+    auto slot = &counter->slot[cpuid()].count;
+    __atomic_store_n(slot, __atomic_load_n(slot, __ATOMIC_RELAXED) + delta,
+                     __ATOMIC_RELAXED);
+}
+
+isize percpu_counter_sum(PercpuCounter *counter)
+{
+    isize sum = 0;
+    for (int i = 0; i < PERCPU_COUNTER_SLOTS; ++i)
+        sum += __atomic_load_n(&counter->slot[i].count, __ATOMIC_RELAXED);
+    return sum;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <common/defines.h>
+
+// number of slots in a counter. It must be no less than NCPU.
+#define PERCPU_COUNTER_SLOTS 4
+
+/**
+ * A counter for hot statistics, split into one slot per CPU.
+ *
+ * Every slot has its own cache line, and an update only touches the slot
+ * of the current CPU, so CPUs updating the same counter never contend.
+ * Reading the value sums all slots: the result is exact if all updates are
+ * serialized with the read (e.g. by a lock), and otherwise a snapshot that
+ * may miss updates in flight.
+ */
+typedef struct {
+    struct {
+        isize count;
+    } CACHE_ALIGNED slot[PERCPU_COUNTER_SLOTS];
+} PercpuCounter;
+
+void init_percpu_counter(PercpuCounter *counter, isize value);
+void percpu_counter_add(PercpuCounter *counter, isize delta);
+#define percpu_counter_inc(counter) percpu_counter_add(counter, 1)
+#define percpu_counter_dec(counter) percpu_counter_add(counter, -1)
+WARN_RESULT isize percpu_counter_sum(PercpuCounter *counter);
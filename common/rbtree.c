@@ -45,7 +45,17 @@ static inline void __rb_rotate_set_parents(rb_node old, rb_node new,
     rb_set_parent_color(old, new, color);
     __rb_change_child(old, new, parent, root);
 }
-static void __rb_insert_fix(rb_node node, rb_root root)
+/* Recompute the augmented data after rotating `old` down below `new`. */
+static inline void __rb_rotate_augment(rb_node old, rb_node new,
+                                       const struct rb_augment *aug)
+{
+    if (aug) {
+        aug->update(old);
+        aug->update(new);
+    }
+}
+static void __rb_insert_fix(rb_node node, rb_root root,
+                            const struct rb_augment *aug)
 {
     rb_node parent = rb_red_parent(node), gparent, tmp;
     while (1) {
@@ -75,6 +85,7 @@ static void __rb_insert_fix(rb_node node, rb_root root)
                     rb_set_parent_color(tmp, parent, RB_BLACK);
                 node->rb_left = parent;
                 rb_set_parent_color(parent, node, RB_RED);
+                __rb_rotate_augment(parent, node, aug);
                 parent = node;
                 tmp = node->rb_right;
             }
@@ -84,6 +95,7 @@ static void __rb_insert_fix(rb_node node, rb_root root)
                 rb_set_parent_color(tmp, gparent, RB_BLACK);
             parent->rb_right = gparent;
             __rb_rotate_set_parents(gparent, parent, root, RB_RED);
+            __rb_rotate_augment(gparent, parent, aug);
             break;
         } else {
             tmp = gparent->rb_left;
@@ -103,6 +115,7 @@ static void __rb_insert_fix(rb_node node, rb_root root)
                     rb_set_parent_color(tmp, parent, RB_BLACK);
                 node->rb_right = parent;
                 rb_set_parent_color(parent, node, RB_RED);
+                __rb_rotate_augment(parent, node, aug);
                 parent = node;
                 tmp = node->rb_left;
             }
@@ -112,14 +125,18 @@ static void __rb_insert_fix(rb_node node, rb_root root)
                 rb_set_parent_color(tmp, gparent, RB_BLACK);
             parent->rb_left = gparent;
             __rb_rotate_set_parents(gparent, parent, root, RB_RED);
+            __rb_rotate_augment(gparent, parent, aug);
             break;
         }
     }
 }
-static rb_node __rb_erase(rb_node node, rb_root root)
+static rb_node __rb_erase(rb_node node, rb_root root,
+                          const struct rb_augment *aug)
 {
     rb_node child = node->rb_right, tmp = node->rb_left;
     rb_node parent, rebalance;
+    // the lowest node whose subtree has changed.
+    rb_node changed;
     unsigned long pc;
     if (!tmp) {
         pc = node->__rb_parent_color;
@@ -130,17 +147,20 @@ static rb_node __rb_erase(rb_node node, rb_root root)
             rebalance = NULL;
         } else
             rebalance = __rb_is_black(pc) ? parent : NULL;
+        changed = parent;
     } else if (!child) {
         tmp->__rb_parent_color = pc = node->__rb_parent_color;
         parent = __rb_parent(pc);
         __rb_change_child(node, tmp, parent, root);
         rebalance = NULL;
+        changed = parent;
     } else {
         rb_node successor = child, child2;
         tmp = child->rb_left;
         if (!tmp) {
             parent = successor;
             child2 = successor->rb_right;
+            changed = successor;
         } else {
             do {
                 parent = successor;
@@ -150,6 +170,7 @@ static rb_node __rb_erase(rb_node node, rb_root root)
             parent->rb_left = child2 = successor->rb_right;
             successor->rb_right = child;
             rb_set_parent(child, successor);
+            changed = parent;
         }
         successor->rb_left = tmp = node->rb_left;
         rb_set_parent(tmp, successor);
@@ -166,9 +187,16 @@ static rb_node __rb_erase(rb_node node, rb_root root)
             rebalance = __rb_is_black(pc2) ? parent : NULL;
         }
     }
+    // the successor took the place of `node` and holds stale data, so
+    // update all the way up.
+    if (aug) {
+        for (; changed; changed = rb_parent(changed))
+            aug->update(changed);
+    }
     return rebalance;
 }
-static void __rb_erase_fix(rb_node parent, rb_root root)
+static void __rb_erase_fix(rb_node parent, rb_root root,
+                           const struct rb_augment *aug)
 {
     rb_node node = NULL, sibling, tmp1, tmp2;
     while (1) {
@@ -179,6 +207,7 @@ static void __rb_erase_fix(rb_node parent, rb_root root)
                 rb_set_parent_color(tmp1, parent, RB_BLACK);
                 sibling->rb_left = parent;
                 __rb_rotate_set_parents(parent, sibling, root, RB_RED);
+                __rb_rotate_augment(parent, sibling, aug);
                 sibling = tmp1;
             }
             tmp1 = sibling->rb_right;
@@ -202,6 +231,7 @@ static void __rb_erase_fix(rb_node parent, rb_root root)
                         rb_set_parent_color(tmp1, sibling, RB_BLACK);
                     tmp2->rb_right = sibling;
                     parent->rb_right = tmp2;
+                    __rb_rotate_augment(sibling, tmp2, aug);
                     tmp1 = sibling;
                     sibling = tmp2;
                 }
@@ -212,6 +242,7 @@ static void __rb_erase_fix(rb_node parent, rb_root root)
             sibling->rb_left = parent;
             rb_set_parent_color(tmp1, sibling, RB_BLACK);
             __rb_rotate_set_parents(parent, sibling, root, RB_BLACK);
+            __rb_rotate_augment(parent, sibling, aug);
             break;
         } else {
             sibling = parent->rb_left;
@@ -220,6 +251,7 @@ static void __rb_erase_fix(rb_node parent, rb_root root)
                 rb_set_parent_color(tmp1, parent, RB_BLACK);
                 sibling->rb_right = parent;
                 __rb_rotate_set_parents(parent, sibling, root, RB_RED);
+                __rb_rotate_augment(parent, sibling, aug);
                 sibling = tmp1;
             }
             tmp1 = sibling->rb_left;
@@ -243,6 +275,7 @@ static void __rb_erase_fix(rb_node parent, rb_root root)
                         rb_set_parent_color(tmp1, sibling, RB_BLACK);
                     tmp2->rb_left = sibling;
                     parent->rb_left = tmp2;
+                    __rb_rotate_augment(sibling, tmp2, aug);
                     tmp1 = sibling;
                     sibling = tmp2;
                 }
@@ -253,12 +286,14 @@ static void __rb_erase_fix(rb_node parent, rb_root root)
             sibling->rb_right = parent;
             rb_set_parent_color(tmp1, sibling, RB_BLACK);
             __rb_rotate_set_parents(parent, sibling, root, RB_BLACK);
+            __rb_rotate_augment(parent, sibling, aug);
             break;
         }
     }
 }
-int _rb_insert(rb_node node, rb_root rt,
-               bool (*cmp)(rb_node lnode, rb_node rnode))
+int _rb_insert_augmented(rb_node node, rb_root rt,
+                         bool (*cmp)(rb_node lnode, rb_node rnode),
+                         const struct rb_augment *aug)
 {
     rb_node nw = rt->rb_node, parent = NULL;
     node->rb_left = node->rb_right = NULL;
@@ -280,15 +315,32 @@ int _rb_insert(rb_node node, rb_root rt,
         } else
             return -1;
     }
-    __rb_insert_fix(node, rt);
+    if (aug) {
+        // only the path to the new node has changed. Stop once a node
+        // keeps its data, since its ancestors keep theirs too.
+        aug->update(node);
+        for (rb_node p = rb_parent(node); p && aug->update(p); p = rb_parent(p))
+            ;
+    }
+    __rb_insert_fix(node, rt, aug);
     return 0;
 }
-void _rb_erase(rb_node node, rb_root root)
+int _rb_insert(rb_node node, rb_root rt,
+               bool (*cmp)(rb_node lnode, rb_node rnode))
+{
+    return _rb_insert_augmented(node, rt, cmp, NULL);
+}
+void _rb_erase_augmented(rb_node node, rb_root root,
+                         const struct rb_augment *aug)
 {
     rb_node rebalance;
-    rebalance = __rb_erase(node, root);
+    rebalance = __rb_erase(node, root, aug);
     if (rebalance)
-        __rb_erase_fix(rebalance, root);
+        __rb_erase_fix(rebalance, root, aug);
+}
+void _rb_erase(rb_node node, rb_root root)
+{
+    _rb_erase_augmented(node, root, NULL);
 }
 rb_node _rb_lookup(rb_node node, rb_root rt,
                    bool (*cmp)(rb_node lnode, rb_node rnode))
@@ -313,4 +365,45 @@ rb_node _rb_first(rb_root root)
     while (n->rb_left)
         n = n->rb_left;
     return n;
-}
\ No newline at end of file
+}
+
+rb_node _rb_last(rb_root root)
+{
+    rb_node n;
+    n = root->rb_node;
+    if (!n)
+        return NULL;
+    while (n->rb_right)
+        n = n->rb_right;
+    return n;
+}
+
+rb_node _rb_next(rb_node node)
+{
+    rb_node parent;
+    if (node->rb_right) {
+        node = node->rb_right;
+        while (node->rb_left)
+            node = node->rb_left;
+        return node;
+    }
+    /* go up until we come from a left child */
+    while ((parent = rb_parent(node)) && node == parent->rb_right)
+        node = parent;
+    return parent;
+}
+
+rb_node _rb_prev(rb_node node)
+{
+    rb_node parent;
+    if (node->rb_left) {
+        node = node->rb_left;
+        while (node->rb_right)
+            node = node->rb_right;
+        return node;
+    }
+    /* go up until we come from a right child */
+    while ((parent = rb_parent(node)) && node == parent->rb_left)
+        node = parent;
+    return parent;
+}
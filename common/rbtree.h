@@ -13,6 +13,16 @@ struct rb_root_ {
 };
 typedef struct rb_root_ *rb_root;
 
+/*
+ * Data kept in every node about its whole subtree, e.g. the max end of the
+ * intervals in an interval tree. `update` recomputes the data of `node`
+ * from the node itself and its children, and returns whether it changed.
+ * The tree calls it wherever a subtree changes.
+ */
+struct rb_augment {
+    bool (*update)(rb_node node);
+};
+
 /* NOTE:You should add lock when use */
 WARN_RESULT int _rb_insert(rb_node node, rb_root root,
                            bool (*cmp)(rb_node lnode, rb_node rnode));
@@ -20,3 +30,13 @@ void _rb_erase(rb_node node, rb_root root);
 rb_node _rb_lookup(rb_node node, rb_root rt,
                    bool (*cmp)(rb_node lnode, rb_node rnode));
 rb_node _rb_first(rb_root root);
+rb_node _rb_last(rb_root root);
+/* In-order successor and predecessor, NULL at the end. */
+rb_node _rb_next(rb_node node);
+rb_node _rb_prev(rb_node node);
+
+WARN_RESULT int _rb_insert_augmented(rb_node node, rb_root root,
+                                     bool (*cmp)(rb_node lnode, rb_node rnode),
+                                     const struct rb_augment *aug);
+void _rb_erase_augmented(rb_node node, rb_root root,
+                         const struct rb_augment *aug);
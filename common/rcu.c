@@ -0,0 +1,83 @@
+#include <aarch64/intrinsic.h>
+#include <common/rcu.h>
+#include <kernel/cpu.h>
+
+// the current epoch.
+static u64 rcu_epoch;
+
+static struct rcu_cpu {
+    // the last epoch in which this CPU passed a quiescent point.
+    u64 seen;
+    // depth of nested read-side critical sections.
+    int nesting;
+    // pending callbacks in the order they were queued, so their epochs
+    // never decrease.
+    RcuHead *head, *tail;
+} CACHE_ALIGNED rcu_cpus[NCPU];
+
+// the per-CPU state needs no lock: traps are disabled in the kernel, so
+// nothing else runs on this CPU while we use it.
+
+void rcu_read_lock()
+{
+    rcu_cpus[cpuid()].nesting++;
+    compiler_fence();
+}
+
+void rcu_read_unlock()
+{
+    compiler_fence();
+    auto rc = &rcu_cpus[cpuid()];
+    ASSERT(rc->nesting > 0);
+    rc->nesting--;
+}
+
+void call_rcu(RcuHead *head, void (*func)(RcuHead *))
+{
+    auto rc = &rcu_cpus[cpuid()];
+    head->next = NULL;
+    head->func = func;
+    // the object was unlinked before this load, so the readers that can
+    // still find it started no later than this epoch.
+    head->epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST);
+    if (rc->tail == NULL)
+        rc->head = head;
+    else
+        rc->tail->next = head;
+    rc->tail = head;
+}
+
+void rcu_quiescent()
+{
+    auto rc = &rcu_cpus[cpuid()];
+    ASSERT(rc->nesting == 0);
+    u64 epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST);
+    if (rc->seen != epoch) {
+        __atomic_store_n(&rc->seen, epoch, __ATOMIC_SEQ_CST);
+        // the last CPU to pass a quiescent point ends the epoch.
+        bool done = true;
+        for (int i = 0; i < NCPU; ++i) {
+            if (__atomic_load_n(&rcu_cpus[i].seen, __ATOMIC_SEQ_CST) != epoch) {
+                done = false;
+                break;
+            }
+        }
+        if (done)
+            __atomic_compare_exchange_n(&rcu_epoch, &epoch, epoch + 1, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+}
+
+void rcu_run_callbacks()
+{
+    auto rc = &rcu_cpus[cpuid()];
+    ASSERT(rc->nesting == 0);
+    u64 epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST);
+    while (rc->head != NULL && rc->head->epoch + 2 <= epoch) {
+        RcuHead *head = rc->head;
+        rc->head = head->next;
+        if (rc->head == NULL)
+            rc->tail = NULL;
+        head->func(head);
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <common/defines.h>
+
+/**
+ * Epoch-based deferred reclamation, a small RCU.
+ *
+ * Readers walk a shared structure between `rcu_read_lock` and
+ * `rcu_read_unlock` without taking its lock. They must not sleep there.
+ * Writers still serialize among themselves, unlink an object, and hand it
+ * to `call_rcu` instead of freeing it at once.
+ *
+ * Every call to `sched` is a quiescent point of its CPU: since traps are
+ * disabled in the kernel, no read-side critical section can be in
+ * progress there. A global epoch advances once every CPU has passed a
+ * quiescent point in the current epoch. A callback queued in epoch `e`
+ * runs when the epoch reaches `e + 2`; by then every CPU has passed a
+ * quiescent point that started after the `call_rcu`, so no reader can
+ * still hold the object.
+ *
+ * Callbacks run at the end of `sched` on the CPU that queued them, after
+ * the scheduler lock is released. They may free memory, but must not
+ * sleep.
+ */
+typedef struct rcu_head {
+    struct rcu_head *next;
+    u64 epoch;
+    void (*func)(struct rcu_head *);
+} RcuHead;
+
+void rcu_read_lock();
+void rcu_read_unlock();
+
+// run `func(head)` once all current readers are gone.
+void call_rcu(RcuHead *head, void (*func)(RcuHead *));
+
+// report a quiescent point of this CPU. Called by `sched`.
+void rcu_quiescent();
+// run the callbacks of this CPU that are due. Called by `sched` once it has
+// released the scheduler lock.
+void rcu_run_callbacks();
+
+// publish `v` through `p`: a reader that sees `v` also sees its contents.
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+// load a pointer published with `rcu_assign_pointer`.
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
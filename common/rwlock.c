@@ -0,0 +1,100 @@
+#include <aarch64/intrinsic.h>
+#include <common/rwlock.h>
+
+void init_rwlock(RWLock *lock)
+{
+    lock->cnt = 0;
+}
+
+bool try_acquire_read_lock(RWLock *lock)
+{
+    u32 cnt = __atomic_load_n(&lock->cnt, __ATOMIC_RELAXED);
+    while (!(cnt & (RWLOCK_WRITER | RWLOCK_WAITING))) {
+        if (__atomic_compare_exchange_n(&lock->cnt, &cnt, cnt + 1, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return true;
+    }
+    return false;
+}
+
+void acquire_read_lock(RWLock *lock)
+{
+    while (!try_acquire_read_lock(lock))
+        arch_wfe();
+}
+
+void release_read_lock(RWLock *lock)
+{
+    u32 cnt = __atomic_sub_fetch(&lock->cnt, 1, __ATOMIC_RELEASE);
+    // only a waiting writer cares about the last reader leaving.
+    if (cnt == RWLOCK_WAITING) {
+        arch_dsb_sy();
+        arch_sev();
+    }
+}
+
+bool try_acquire_write_lock(RWLock *lock)
+{
+    u32 cnt = __atomic_load_n(&lock->cnt, __ATOMIC_RELAXED);
+    while ((cnt & ~RWLOCK_WAITING) == 0) {
+        // taking the lock clears RWLOCK_WAITING. Other waiting writers set
+        // it again before they wait.
+        if (__atomic_compare_exchange_n(&lock->cnt, &cnt, RWLOCK_WRITER, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return true;
+    }
+    return false;
+}
+
+void acquire_write_lock(RWLock *lock)
+{
+    while (!try_acquire_write_lock(lock)) {
+        __atomic_fetch_or(&lock->cnt, RWLOCK_WAITING, __ATOMIC_RELAXED);
+        // a release between the check and WFE leaves the event register set
+        // by its SEV, so no wakeup is lost.
+        if (__atomic_load_n(&lock->cnt, __ATOMIC_RELAXED) & ~RWLOCK_WAITING)
+            arch_wfe();
+    }
+}
+
+void release_write_lock(RWLock *lock)
+{
+    __atomic_store_n(&lock->cnt, 0, __ATOMIC_RELEASE);
+    arch_dsb_sy();
+    arch_sev();
+}
+
+void init_seqlock(SeqLock *lock)
+{
+    lock->seq = 0;
+    init_spinlock(&lock->lock);
+}
+
+u32 read_seqbegin(SeqLock *lock)
+{
+    u32 seq;
+    while ((seq = __atomic_load_n(&lock->seq, __ATOMIC_ACQUIRE)) & 1)
+        arch_yield();
+    return seq;
+}
+
+bool read_seqretry(SeqLock *lock, u32 seq)
+{
+    // the reads of the data must be done before `seq` is checked again.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&lock->seq, __ATOMIC_RELAXED) != seq;
+}
+
+void write_seqlock(SeqLock *lock)
+{
+    acquire_spinlock(&lock->lock);
+    __atomic_store_n(&lock->seq, lock->seq + 1, __ATOMIC_RELAXED);
+    // readers must see the odd `seq` before any of the new data.
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void write_sequnlock(SeqLock *lock)
+{
+    __atomic_store_n(&lock->seq, lock->seq + 1, __ATOMIC_RELEASE);
+    release_spinlock(&lock->lock);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <common/defines.h>
+#include <common/spinlock.h>
+
+/**
+ * Reader-writer spinlock. It is held by any number of readers, or by a
+ * single writer.
+ *
+ * `cnt` holds the number of readers, RWLOCK_WRITER while a writer holds the
+ * lock, and RWLOCK_WAITING while a writer waits for it. New readers stay out
+ * as long as a writer waits, so a steady stream of readers cannot starve
+ * the writers. Waiters sleep with WFE like `SpinLock`.
+ */
+typedef struct {
+    u32 cnt;
+} RWLock;
+
+#define RWLOCK_WRITER BIT(31)
+#define RWLOCK_WAITING BIT(30)
+
+void init_rwlock(RWLock *);
+WARN_RESULT bool try_acquire_read_lock(RWLock *);
+void acquire_read_lock(RWLock *);
+void release_read_lock(RWLock *);
+WARN_RESULT bool try_acquire_write_lock(RWLock *);
+void acquire_write_lock(RWLock *);
+void release_write_lock(RWLock *);
+
+/**
+ * Sequence lock, for small data that is read far more often than written.
+ *
+ * Writers serialize on `lock` and make `seq` odd while they update the
+ * data. Readers take no lock at all: they copy the data and retry if a
+ * writer was active in the meantime.
+ *
+ *     u32 seq;
+ *     do {
+ *         seq = read_seqbegin(&sl);
+ *         copy = data;
+ *     } while (read_seqretry(&sl, seq));
+ *
+ * A reader may see a half-written copy before it retries, so it must not
+ * follow pointers out of the protected data.
+ */
+typedef struct {
+    u32 seq;
+    SpinLock lock;
+} SeqLock;
+
+void init_seqlock(SeqLock *);
+WARN_RESULT u32 read_seqbegin(SeqLock *);
+WARN_RESULT bool read_seqretry(SeqLock *, u32 seq);
+void write_seqlock(SeqLock *);
+void write_sequnlock(SeqLock *);
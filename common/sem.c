@@ -1,5 +1,5 @@
 #include <common/sem.h>
-#include <kernel/mem.h>
+#include <kernel/cpu.h>
 #include <kernel/sched.h>
 #include <kernel/printk.h>
 #include <common/list.h>
@@ -9,6 +9,24 @@ void init_sem(Semaphore *sem, int val)
     sem->val = val;
     init_spinlock(&sem->lock);
     init_list_node(&sem->sleeplist);
+#if LOCKSTAT
+    sem->profile = true;
+#endif
+}
+
+// record a successful wait in the lock profile. Call with the lock of `sem`.
+static INLINE void _sem_stat(Semaphore *sem, void *site, u64 start)
+{
+#if LOCKSTAT
+    if (!sem->profile)
+        return;
+    bool contended = start != 0;
+    // semaphores have no owner to account a hold time to.
+    (void)lockstat_acquire(LOCKSTAT_SEMAPHORE, (u64)site, contended,
+                           contended ? get_timestamp() - start : 0);
+#else
+    (void)sem, (void)site, (void)start;
+#endif
 }
 
 void _lock_sem(Semaphore *sem)
@@ -59,13 +77,22 @@ int post_all_sem(Semaphore *sem)
     return ret;
 }
 
-bool _wait_sem(Semaphore *sem, bool alertable)
+bool wake_one_sem(Semaphore *sem)
 {
-    if (--sem->val >= 0) {
-        release_spinlock(&sem->lock);
-        return true;
+    bool ret = false;
+    _lock_sem(sem);
+    if (sem->val < 0) {
+        _post_sem(sem);
+        ret = true;
     }
-    WaitData *wait = kalloc(sizeof(WaitData));
+    _unlock_sem(sem);
+    return ret;
+}
+
+// sleep in the sleep list of `sem`. Call with the lock of `sem`; it is
+// held again on return.
+static void _sleep_on_sem(Semaphore *sem, WaitData *wait, bool alertable)
+{
     wait->proc = thisproc();
     wait->up = false;
     _insert_into_list(&sem->sleeplist, &wait->slnode);
@@ -78,10 +105,71 @@ bool _wait_sem(Semaphore *sem, bool alertable)
         ASSERT(++sem->val <= 0);
         _detach_from_list(&wait->slnode);
     }
+}
+
+bool _wait_sem(Semaphore *sem, bool alertable)
+{
+    if (--sem->val >= 0) {
+        _sem_stat(sem, __builtin_return_address(0), 0);
+        release_spinlock(&sem->lock);
+        return true;
+    }
+    // nobody refers to the node after we leave the sleep list, so it can
+    // stay on the stack.
+    WaitData wait;
+    u64 start = get_timestamp();
+    _sleep_on_sem(sem, &wait, alertable);
+    if (wait.up)
+        _sem_stat(sem, __builtin_return_address(0), start);
     release_spinlock(&sem->lock);
-    bool ret = wait->up;
-    kfree(wait);
-    return ret;
+    return wait.up;
+}
+
+struct timed_wait {
+    WaitData wait;
+    Semaphore *sem;
+    struct timer timer;
+    // set when the timer handler is done with this struct.
+    bool fired;
+};
+
+static void _wait_timeout(struct timer *timer)
+{
+    auto tw = container_of(timer, struct timed_wait, timer);
+    auto sem = tw->sem;
+    _lock_sem(sem);
+    if (!tw->wait.up)
+        activate_proc(tw->wait.proc);
+    // the waiter may return as soon as it sees this.
+    __atomic_store_n(&tw->fired, true, __ATOMIC_RELEASE);
+    _unlock_sem(sem);
+}
+
+bool _wait_sem_timeout(Semaphore *sem, u64 ms)
+{
+    if (--sem->val >= 0) {
+        _sem_stat(sem, __builtin_return_address(0), 0);
+        release_spinlock(&sem->lock);
+        return true;
+    }
+    u64 start = get_timestamp();
+    struct timed_wait tw;
+    tw.sem = sem;
+    tw.fired = false;
+    tw.timer.elapse = ms;
+    tw.timer.handler = _wait_timeout;
+    set_cpu_timer(&tw.timer);
+    _sleep_on_sem(sem, &tw.wait, true);
+    if (tw.wait.up)
+        _sem_stat(sem, __builtin_return_address(0), start);
+    release_spinlock(&sem->lock);
+    // we may run on another CPU than the timer now. If it has fired, its
+    // handler may still be using `tw`.
+    if (!try_cancel_cpu_timer(&tw.timer)) {
+        while (!__atomic_load_n(&tw.fired, __ATOMIC_ACQUIRE))
+            arch_yield();
+    }
+    return tw.wait.up;
 }
 
 void _post_sem(Semaphore *sem)
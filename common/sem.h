@@ -4,6 +4,7 @@
 
 struct Proc;
 
+// a waiter in the sleep list. It lives in the stack frame of the waiter.
 typedef struct {
     bool up;
     struct Proc *proc;
@@ -14,18 +15,29 @@ typedef struct {
     SpinLock lock;
     int val;
     ListNode sleeplist;
+#if LOCKSTAT
+    // record successful waits in the lock profile. Off for the semaphore of
+    // a Mutex, which records them itself.
+    bool profile;
+#endif
 } Semaphore;
 
 void init_sem(Semaphore *, int val);
 void _post_sem(Semaphore *);
 WARN_RESULT bool _wait_sem(Semaphore *, bool alertable);
+// like an alertable `_wait_sem`, but give up after `ms` milliseconds.
+WARN_RESULT bool _wait_sem_timeout(Semaphore *, u64 ms);
 bool _get_sem(Semaphore *);
 WARN_RESULT int _query_sem(Semaphore *);
 void _lock_sem(Semaphore *);
 void _unlock_sem(Semaphore *);
 int get_all_sem(Semaphore *);
 int post_all_sem(Semaphore *);
+// wake up one waiter, if any. Unlike `post_sem`, nothing is left for later
+// waiters when nobody waits.
+bool wake_one_sem(Semaphore *);
 #define wait_sem(sem) (_lock_sem(sem), _wait_sem(sem, true))
+#define wait_sem_timeout(sem, ms) (_lock_sem(sem), _wait_sem_timeout(sem, ms))
 #define unalertable_wait_sem(sem) \
     ASSERT((_lock_sem(sem), _wait_sem(sem, false)))
 #define post_sem(sem) (_lock_sem(sem), _post_sem(sem), _unlock_sem(sem))
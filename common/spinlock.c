@@ -3,26 +3,59 @@
 
 void init_spinlock(SpinLock *lock)
 {
-    lock->locked = 0;
+    lock->next = lock->owner = 0;
+#if LOCKSTAT
+    lock->stat = NULL;
+#endif
 }
 
 bool try_acquire_spinlock(SpinLock *lock)
 {
-    if (!lock->locked &&
-        !__atomic_test_and_set(&lock->locked, __ATOMIC_ACQUIRE)) {
-        return true;
-    } else {
+    // the lock is free iff nobody holds a ticket that has not been served.
+    u32 owner = __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+    u32 next = owner;
+    if (!__atomic_compare_exchange_n(&lock->next, &next, owner + 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
         return false;
-    }
+#if LOCKSTAT
+    lock->since = get_timestamp();
+    lock->stat = lockstat_acquire(LOCKSTAT_SPINLOCK,
+                                  (u64)__builtin_return_address(0), false, 0);
+#endif
+    return true;
 }
 
 void acquire_spinlock(SpinLock *lock)
 {
-    while (!try_acquire_spinlock(lock))
-        arch_yield();
+    u32 ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+#if LOCKSTAT
+    u64 start = get_timestamp();
+#endif
+    bool contended = false;
+    // a release between the check and WFE leaves the event register set by
+    // its SEV, so WFE returns at once and no wakeup is lost.
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        contended = true;
+        arch_wfe();
+    }
+#if LOCKSTAT
+    lock->since = contended ? get_timestamp() : start;
+    lock->stat = lockstat_acquire(LOCKSTAT_SPINLOCK,
+                                  (u64)__builtin_return_address(0), contended,
+                                  lock->since - start);
+#else
+    (void)contended;
+#endif
 }
 
 void release_spinlock(SpinLock *lock)
 {
-    __atomic_clear(&lock->locked, __ATOMIC_RELEASE);
+#if LOCKSTAT
+    if (lock->stat != NULL)
+        lockstat_release(lock->stat, get_timestamp() - lock->since);
+#endif
+    __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+    // the new owner must be visible before the waiters wake up.
+    arch_dsb_sy();
+    arch_sev();
 }
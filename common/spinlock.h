@@ -1,10 +1,23 @@
 #pragma once
 
 #include <common/defines.h>
+#include <common/lockstat.h>
 #include <aarch64/intrinsic.h>
 
+/**
+ * Ticket spinlock. Waiters take a ticket from `next` and wait with WFE until
+ * `owner` reaches their ticket, so the lock is handed out in FIFO order and
+ * every release wakes the waiters with SEV.
+ *
+ * With LOCKSTAT, every acquisition and hold time is recorded in the lock
+ * profile, see `lockstat.h`. `since` is when the holder took the lock.
+ */
 typedef struct {
-    volatile bool locked;
+    u32 next, owner;
+#if LOCKSTAT
+    struct lockstat *stat;
+    u64 since;
+#endif
 } SpinLock;
 
 void init_spinlock(SpinLock *);
@@ -1,5 +1,8 @@
 #include <common/string.h>
 
+// aarch64 has its own mem* routines in aarch64/string.S.
+#ifndef __aarch64__
+
 void *memset(void *s, int c, usize n)
 {
     for (usize i = 0; i < n; i++)
@@ -49,13 +52,38 @@ void *memmove(void *dest, const void *src, usize n)
     return dest;
 }
 
+#endif
+
+// loads of whole words out of char arrays.
+typedef u64 __attribute__((may_alias)) Word;
+
+/**
+ * The string routines below work a word at a time where they can. An aligned
+ * word never crosses a page, so reading it past the end of a string is safe.
+ * Unaligned heads and all tails are handled byte by byte.
+ */
+
 char *strncpy(char *restrict dest, const char *restrict src, usize n)
 {
     usize i = 0;
+    if ((((usize)dest ^ (usize)src) & 7) == 0) {
+        for (; i < n && ((usize)(src + i) & 7); i++) {
+            if ((dest[i] = src[i]) == '\0') {
+                memset(dest + i, 0, n - i);
+                return dest;
+            }
+        }
+        for (; i + 8 <= n; i += 8) {
+            Word w = *(const Word *)(src + i);
+            if (has_zero_byte(w))
+                break;
+            *(Word *)(dest + i) = w;
+        }
+    }
     for (; i < n && src[i] != '\0'; i++)
         dest[i] = src[i];
-    for (; i < n; i++)
-        dest[i] = '\0';
+    if (i < n)
+        memset(dest + i, 0, n - i);
 
     return dest;
 }
@@ -63,6 +91,18 @@ char *strncpy(char *restrict dest, const char *restrict src, usize n)
 char *strncpy_fast(char *restrict dest, const char *restrict src, usize n)
 {
     usize i = 0;
+    if ((((usize)dest ^ (usize)src) & 7) == 0) {
+        for (; i < n && ((usize)(src + i) & 7); i++) {
+            if ((dest[i] = src[i]) == '\0')
+                return dest;
+        }
+        for (; i + 8 <= n; i += 8) {
+            Word w = *(const Word *)(src + i);
+            if (has_zero_byte(w))
+                break;
+            *(Word *)(dest + i) = w;
+        }
+    }
     for (; i < n && src[i] != '\0'; i++)
         dest[i] = src[i];
     if (i < n)
@@ -73,7 +113,23 @@ char *strncpy_fast(char *restrict dest, const char *restrict src, usize n)
 
 int strncmp(const char *s1, const char *s2, usize n)
 {
-    for (usize i = 0; i < n; i++) {
+    usize i = 0;
+    if ((((usize)s1 ^ (usize)s2) & 7) == 0) {
+        for (; i < n && ((usize)(s1 + i) & 7); i++) {
+            if (s1[i] != s2[i])
+                return s1[i] - s2[i];
+            if (s1[i] == '\0')
+                return 0;
+        }
+        // skip equal words without a terminator; the byte loop below finds
+        // the exact difference.
+        for (; i + 8 <= n; i += 8) {
+            Word w = *(const Word *)(s1 + i);
+            if (w != *(const Word *)(s2 + i) || has_zero_byte(w))
+                break;
+        }
+    }
+    for (; i < n; i++) {
         if (s1[i] != s2[i])
             return s1[i] - s2[i];
         if (s1[i] == '\0' || s2[i] == '\0')
@@ -85,9 +141,15 @@ int strncmp(const char *s1, const char *s2, usize n)
 
 usize strlen(const char *s)
 {
-    usize i = 0;
-    while (s[i] != '\0')
-        i++;
+    const char *p = s;
+    for (; (usize)p & 7; p++) {
+        if (*p == '\0')
+            return p - s;
+    }
+    while (!has_zero_byte(*(const Word *)p))
+        p += 8;
+    while (*p != '\0')
+        p++;
 
-    return i;
+    return p - s;
 }
@@ -23,3 +23,16 @@ char *strncpy_fast(char *restrict dest, const char *restrict src, usize n);
 
 WARN_RESULT int strncmp(const char *s1, const char *s2, usize n);
 WARN_RESULT usize strlen(const char *s);
+
+// the top bit of every zero byte of `w`. Bytes above the first zero byte
+// may be flagged by mistake, so only its lowest set bit is exact.
+static INLINE u64 zero_byte_mask(u64 w)
+{
+    return (w - 0x0101010101010101ull) & ~w & 0x8080808080808080ull;
+}
+
+// whether any byte of `w` is zero.
+static INLINE bool has_zero_byte(u64 w)
+{
+    return zero_byte_mask(w) != 0;
+}
@@ -33,8 +33,15 @@ static SpinLock lock;
 
 static SpinLock loglock, listlock;
 static SpinLock bitmaplock;
+// where `cache_alloc` starts to look for a free block. It is protected by
+// `bitmaplock`.
+static usize alloc_hint;
+// cached blocks, most recently used first.
 static ListNode head;
+// the same blocks indexed by `block_no`. It is protected by `lock`.
+static HashTable table;
 static LogHeader header;
+// number of cached blocks. It is protected by `lock`.
 static usize blocknum;
 
 /**
@@ -102,7 +109,7 @@ static void init_block(Block *block) {
     block->acquired = false;
     block->pinned = false;
 
-    init_sleeplock(&block->lock);
+    init_mutex(&block->lock);
     block->valid = false;
     memset(block->data, 0, sizeof(block->data));
 }
@@ -118,21 +125,15 @@ static Block *cache_acquire(usize block_no) {
     // TODO
     acquire_spinlock(&lock);
     Block* ans = NULL;
-    _for_in_list(p, &head){
-        if (p == &head) {
-            break;
-        }
-        Block* now = container_of(p, Block, node);
-        if(now->block_no == block_no) {
-            ans = now;
-            break;
-        }
+    HashNode *node = hashtable_find(&table, block_no, NULL, NULL);
+    if(node != NULL) {
+        ans = container_of(node, Block, hnode);
     }
-    
+
     if(ans) {
         ans->acquired = 1;
         release_spinlock(&lock);
-        bool f = wait_sem(&ans->lock);
+        bool f = acquire_mutex(&ans->lock);
         if(!f) {
             PANIC();
         }
@@ -151,6 +152,7 @@ static Block *cache_acquire(usize block_no) {
             Block* now = container_of(p, Block, node);
             if(!now->acquired && !now->pinned) {
                 detach_from_list(&listlock, p);
+                hashtable_remove(&table, &now->hnode);
                 --blocknum;
                 kfree(now);
             }
@@ -160,7 +162,7 @@ static Block *cache_acquire(usize block_no) {
     ans = kalloc(sizeof(Block));
     init_block(ans);
         
-    bool f = wait_sem(&ans->lock);
+    bool f = acquire_mutex(&ans->lock);
     if(!f) {
         PANIC();
     }
@@ -168,11 +170,12 @@ static Block *cache_acquire(usize block_no) {
     ans->block_no = block_no;
     ans->acquired = 1;
     ans->valid = 1;
-    release_spinlock(&lock);
-    device_read(ans);
-    acquire_spinlock(&lock);
+    // publish it before reading, so that others wait on its mutex instead
+    // of loading the block a second time.
     insert_into_list(&listlock, &head, &ans->node);
+    hashtable_insert(&table, &ans->hnode, block_no);
     release_spinlock(&lock);
+    device_read(ans);
     return ans;
 }
 
@@ -181,7 +184,7 @@ static void cache_release(Block *block) {
     // TODO
     acquire_spinlock(&lock);
     block->acquired = 0;
-    post_sem(&block->lock);
+    release_mutex(&block->lock);
     release_spinlock(&lock);
 }
 
@@ -194,8 +197,10 @@ void init_bcache(const SuperBlock *_sblock, const BlockDevice *_device) {
     init_spinlock(&lock);
     init_spinlock(&loglock);
     init_spinlock(&bitmaplock);
+    alloc_hint = 0;
     init_spinlock(&listlock);
     init_list_node(&head);
+    init_hashtable(&table, 4);
     blocknum = 0;
     header.num_blocks = 0;
     log.outstanding = log.iscommit = 0;
@@ -292,26 +297,35 @@ static void cache_end_op(OpContext *ctx) {
 // see `cache.h`.
 static usize cache_alloc(OpContext *ctx) {
     // TODO
+    const usize bits_per_block = BLOCK_SIZE * 8;
+    const usize num_blocks = sblock->num_blocks;
     acquire_spinlock(&bitmaplock);
-    for(int blockstart = 0; blockstart < (int)sblock->num_blocks; blockstart += BLOCK_SIZE * 8) {
-        Block *mp = cache_acquire(sblock->bitmap_start + blockstart / (BLOCK_SIZE * 8));
-        for(int add = 0; add < BLOCK_SIZE && blockstart + add * 8 < (int)sblock->num_blocks; ++add) {
-            int temp=mp->data[add];
-            for(int i = 0; i < 8 && blockstart + add * 8 + i < (int)sblock->num_blocks; ++i) {
-                if((temp >> i & 1) == 0) {
-                    mp->data[add] |= (1 << i);
-                    cache_sync(ctx, mp);
-                    cache_release(mp);
-                    Block* ans = cache_acquire(blockstart + add * 8 + i);
-                    memset(ans->data, 0, BLOCK_SIZE);
-                    cache_sync(ctx, ans);
-                    cache_release(ans);
-                    release_spinlock(&bitmaplock);
-                    return blockstart + add * 8 + i;
-                }
-            }
+    // search from `alloc_hint` to the end, then wrap around. The block of
+    // the hint is visited twice, so its bits before the hint are searched
+    // last.
+    usize start = alloc_hint;
+    for(usize k = 0; k <= (num_blocks + bits_per_block - 1) / bits_per_block; ++k) {
+        usize base = round_down(start, bits_per_block);
+        usize bits = MIN(bits_per_block, num_blocks - base);
+        Block *mp = cache_acquire(sblock->bitmap_start + base / bits_per_block);
+        // bit i of the on-disk bitmap is bit `i % 8` of byte `i / 8`, which
+        // is also where a little-endian BitmapCell keeps it.
+        BitmapCell *map = (BitmapCell *)mp->data;
+        usize i = bitmap_find_next_zero(map, bits, start - base);
+        if(i < bits) {
+            bitmap_set(map, i);
+            cache_sync(ctx, mp);
+            cache_release(mp);
+            Block* ans = cache_acquire(base + i);
+            memset(ans->data, 0, BLOCK_SIZE);
+            cache_sync(ctx, ans);
+            cache_release(ans);
+            alloc_hint = (base + i + 1) % num_blocks;
+            release_spinlock(&bitmaplock);
+            return base + i;
         }
         cache_release(mp);
+        start = base + bits_per_block < num_blocks ? base + bits_per_block : 0;
     }
     release_spinlock(&bitmaplock);
     PANIC();
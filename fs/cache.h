@@ -1,5 +1,7 @@
 #pragma once
+#include <common/hashtable.h>
 #include <common/list.h>
+#include <common/mutex.h>
 #include <common/sem.h>
 #include <fs/block_device.h>
 #include <fs/defines.h>
@@ -39,6 +41,13 @@ typedef struct {
      */
     ListNode node;
 
+    /**
+        @brief index this block by `block_no` in the table of cached blocks.
+
+        @note should be protected by the global lock of the block cache.
+     */
+    HashNode hnode;
+
     /**
         @brief is the block already acquired by some thread or process?
 
@@ -58,9 +67,9 @@ typedef struct {
     bool pinned;
 
     /**
-        @brief the sleep lock protecting `valid` and `data`.
+        @brief the lock protecting `valid` and `data`.
      */
-    SleepLock lock;
+    Mutex lock;
 
     /**
         @brief is the content of block loaded from disk?
@@ -77,8 +86,10 @@ typedef struct {
     bool valid;
     /**
         @brief the real in-memory content of the block on disk.
+
+        @note aligned so that bitmap blocks can be scanned a word at a time.
      */
-    u8 data[BLOCK_SIZE];
+    u8 data[BLOCK_SIZE] __attribute__((aligned(sizeof(u64))));
 } Block;
 
 /**
@@ -13,6 +13,8 @@ static struct ftable ftable;
 void init_ftable() {
     // TODO: initialize your ftable.
     init_spinlock(&ftable.lock);
+    ftable.filelist = kvalloc(NFILE * sizeof(File));
+    ASSERT(ftable.filelist != NULL);
 }
 
 void init_oftable(struct oftable *oftable) {
@@ -32,7 +32,8 @@ typedef struct file {
 struct ftable {
     // TODO: table of file objects in the system
     SpinLock lock;
-    File filelist[NFILE];
+    // NFILE entries, allocated by `init_ftable`.
+    File *filelist;
     // Note: you may need a lock to prevent concurrent access to the table!
 };
 
@@ -29,19 +29,18 @@ static const BlockCache* cache;
     Use it to protect anything you need.
 
     e.g. the list of allocated blocks, ref counts, etc.
+
+    Lookups take no lock: they walk the inode table under RCU. `lock` only
+    serializes loading inodes, so that each is loaded once.
  */
-static SpinLock lock, listlock;
+static SpinLock lock;
 
 /**
-    @brief the list of all allocated in-memory inodes.
-
-    We use a linked list to manage all allocated inodes.
-
-    You can implement your own data structure if you want better performance.
+    @brief all allocated in-memory inodes, indexed by `inode_no`.
 
     @see Inode
  */
-static ListNode head;
+static HashTable table;
 
 
 // return which block `inode_no` lives on.
@@ -62,8 +61,7 @@ static INLINE u32* get_addrs(Block* block) {
 // initialize inode tree.
 void init_inodes(const SuperBlock* _sblock, const BlockCache* _cache) {
     init_spinlock(&lock);
-    init_spinlock(&listlock);
-    init_list_node(&head);
+    init_hashtable(&table, 4);
     sblock = _sblock;
     cache = _cache;
 
@@ -75,9 +73,8 @@ void init_inodes(const SuperBlock* _sblock, const BlockCache* _cache) {
 
 // initialize in-memory inode.
 static void init_inode(Inode* inode) {
-    init_sleeplock(&inode->lock);
+    init_mutex(&inode->lock);
     init_rc(&inode->rc);
-    init_list_node(&inode->node);
     inode->inode_no = 0;
     inode->valid = false;
 }
@@ -107,14 +104,14 @@ static usize inode_alloc(OpContext* ctx, InodeType type) {
 static void inode_lock(Inode* inode) {
     ASSERT(inode->rc.count > 0);
     // TODO
-    unalertable_wait_sem(&inode->lock);
+    unalertable_acquire_mutex(&inode->lock);
 }
 
 // see `inode.h`.
 static void inode_unlock(Inode* inode) {
     ASSERT(inode->rc.count > 0);
     // TODO
-    post_sem(&inode->lock);
+    release_mutex(&inode->lock);
 }
 
 // see `inode.h`.
@@ -136,6 +133,25 @@ static void inode_sync(OpContext* ctx, Inode* inode, bool do_write) {
     }
 }
 
+// `rc` of an inode that `inode_put` is freeing.
+#define INODE_DEAD (-1)
+
+// take a reference to a found inode, unless `inode_put` is freeing it.
+// Cached inodes may have no reference, so zero is not enough to tell.
+static bool _inode_try_get(HashNode* node, void* arg) {
+    (void)arg;
+    auto inode = container_of(node, Inode, node);
+    isize count = __atomic_load_n(&inode->rc.count, __ATOMIC_RELAXED);
+    do {
+        if(count == INODE_DEAD) {
+            return false;
+        }
+    } while(!__atomic_compare_exchange_n(&inode->rc.count, &count, count + 1,
+                                         true, __ATOMIC_ACQUIRE,
+                                         __ATOMIC_RELAXED));
+    return true;
+}
+
 // see `inode.h`.
 static Inode* inode_get(usize inode_no) {
     ASSERT(inode_no > 0);
@@ -143,18 +159,20 @@ static Inode* inode_get(usize inode_no) {
         printk("%llu %u\n", inode_no, sblock->num_inodes);
     }
     ASSERT(inode_no < sblock->num_inodes);
-    acquire_spinlock(&lock);
     // TODO
-    _for_in_list(p, &head) {
-        if(p == &head) {
-            continue;
-        }
-        auto cur = container_of(p, Inode, node);
-        if(cur->inode_no == inode_no) {
-            increment_rc(&cur->rc);
-            release_spinlock(&lock);
-            return cur;
-        }
+    rcu_read_lock();
+    HashNode *node = hashtable_find_rcu(&table, inode_no, _inode_try_get, NULL);
+    rcu_read_unlock();
+    if(node != NULL) {
+        return container_of(node, Inode, node);
+    }
+    acquire_spinlock(&lock);
+    // the lock-free lookup may miss an inode, and someone may have loaded
+    // it while we did not hold the lock.
+    node = hashtable_find(&table, inode_no, _inode_try_get, NULL);
+    if(node != NULL) {
+        release_spinlock(&lock);
+        return container_of(node, Inode, node);
     }
     Inode *cur = kalloc(sizeof(Inode));
     init_inode(cur);
@@ -163,7 +181,7 @@ static Inode* inode_get(usize inode_no) {
     inode_lock(cur);
     inode_sync(NULL, cur, false);
     inode_unlock(cur);
-    insert_into_list(&listlock, &head, &cur->node);
+    hashtable_insert(&table, &cur->node, inode_no);
     release_spinlock(&lock);
     return cur;
 }
@@ -199,22 +217,30 @@ static Inode* inode_share(Inode* inode) {
     return inode;
 }
 
+// free a dropped inode once no lock-free `inode_get` can see it.
+static void free_inode(RcuHead *rcu) {
+    kfree(container_of(rcu, Inode, rcu));
+}
+
 // see `inode.h`.
 static void inode_put(OpContext* ctx, Inode* inode) {
     // TODO
-    unalertable_wait_sem(&inode->lock);
+    unalertable_acquire_mutex(&inode->lock);
     decrement_rc(&inode->rc);
-    if(inode->rc.count == 0 && inode->entry.num_links == 0) {
+    isize zero = 0;
+    // a lock-free `inode_get` may take a new reference at any time, so
+    // claim the inode atomically before freeing it.
+    if(inode->entry.num_links == 0 &&
+       __atomic_compare_exchange_n(&inode->rc.count, &zero, INODE_DEAD, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
         inode->entry.type = INODE_INVALID;
         inode_clear(ctx, inode);
         inode_sync(ctx, inode, true);
-        acquire_spinlock(&lock);
-        detach_from_list(&listlock, &inode->node);
-        release_spinlock(&lock);
-        post_sem(&inode->lock);
-        kfree(inode);
+        hashtable_remove(&table, &inode->node);
+        release_mutex(&inode->lock);
+        call_rcu(&inode->rcu, free_inode);
     } else {
-        post_sem(&inode->lock);
+        release_mutex(&inode->lock);
     }
 }
 
@@ -270,8 +296,35 @@ static usize inode_map(OpContext* ctx,
     return ans;
 }
 
-static int memcmp2(const char *s1,const char *s2){
-    return memcmp(s1,s2,MAX(strlen(s1),strlen(s2)));
+// the bytes of `w` up to and including its first zero byte.
+static INLINE u64 bytes_to_zero(u64 w) {
+    u64 z = zero_byte_mask(w);
+    return z ? (2ull << __builtin_ctzll(z)) - 1 : ~0ull;
+}
+
+static INLINE u64 load_word(const char *p) {
+    u64 w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+/**
+    @brief compare `name`, zero padded to `FILE_NAME_MAX_LENGTH` bytes,
+    with the name of a directory entry, like `strncmp(name, dname,
+    FILE_NAME_MAX_LENGTH) == 0`.
+
+    The 14 bytes are compared as two overlapping words, bytes 0-7 and
+    6-13. Only bytes up to the terminator of `name` count, so garbage after
+    the terminator of `dname` is ignored.
+ */
+static bool dirent_name_eq(const char *name, const char *dname) {
+    u64 a = load_word(name), mask = bytes_to_zero(a);
+    if ((a ^ load_word(dname)) & mask)
+        return false;
+    if (mask != ~0ull)
+        return true;
+    a = load_word(name + 6);
+    return ((a ^ load_word(dname + 6)) & bytes_to_zero(a)) == 0;
 }
 
 // see `inode.h`.
@@ -340,9 +393,11 @@ static usize inode_lookup(Inode* inode, const char* name, usize* index) {
 
     // TODO
     DirEntry cur;
+    char padded[FILE_NAME_MAX_LENGTH];
+    strncpy(padded, name, FILE_NAME_MAX_LENGTH);
     for(u32 i = 0; i < entry->num_bytes; i += sizeof(cur)) {
         inode_read(inode, (u8*)&cur, i, sizeof(cur));
-        if(cur.inode_no && memcmp2(name, cur.name) == 0) {
+        if(cur.inode_no && dirent_name_eq(padded, cur.name)) {
             if(index) {
                 *index = i;
             }
@@ -358,6 +413,8 @@ static usize inode_lookup2(Inode* inode, const char* name, usize* index) {
 
     // TODO
     DirEntry cur;
+    char padded[FILE_NAME_MAX_LENGTH];
+    strncpy(padded, name, FILE_NAME_MAX_LENGTH);
     if(index) {
         *index = INODE_MAX_BYTES;
     }
@@ -366,7 +423,7 @@ static usize inode_lookup2(Inode* inode, const char* name, usize* index) {
         if(index && cur.inode_no == 0 && *index == INODE_MAX_BYTES) {
             *index = i;
         }
-        if(cur.inode_no && memcmp2(name, cur.name) == 0) {
+        if(cur.inode_no && dirent_name_eq(padded, cur.name)) {
             if(index) {
                 *index = i;
             }
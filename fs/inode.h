@@ -1,6 +1,7 @@
 #pragma once
-#include <common/list.h>
+#include <common/hashtable.h>
 #include <common/rc.h>
+#include <common/rcu.h>
 #include <common/spinlock.h>
 #include <fs/cache.h>
 #include <fs/defines.h>
@@ -25,7 +26,7 @@ typedef struct {
         @note it does NOT protect `rc`, `node`, `valid`, etc, because they are
         "runtime" variables, not "filesystem" metadata or data of the inode.
      */
-    SleepLock lock;
+    Mutex lock;
 
     /**
         @brief the reference count of this inode.
@@ -37,9 +38,15 @@ typedef struct {
     RefCount rc;
 
     /**
-        @brief link this inode into a linked list.
+        @brief index this inode by `inode_no` in the inode table.
      */
-    ListNode node;
+    HashNode node;
+
+    /**
+        @brief defers freeing a dropped inode until no lock-free reader of
+        the inode table can still see it.
+     */
+    RcuHead rcu;
 
     /**
         @brief the corresponding inode number on disk.
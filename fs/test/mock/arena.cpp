@@ -21,4 +21,14 @@ void kfree(void *object)
 {
     free(object);
 }
+
+void *kvalloc(usize size)
+{
+    return calloc(1, size);
+}
+
+void kvfree(void *object)
+{
+    free(object);
+}
 }
@@ -38,7 +38,14 @@ struct Signal {
     }
 };
 
+// storage for the mock semaphore of a kernel Mutex, see `init_mutex`.
+struct SleepMutex {
+    uint64_t sem[2];
+};
+
 Map<void *, Mutex> mtx_map;
+Map<void *, std::shared_mutex> rw_map;
+Map<void *, SleepMutex> sleep_map;
 
 thread_local int holding = 0;
 static struct Blocker {
@@ -91,6 +98,39 @@ bool holding_spinlock(struct SpinLock *lock)
     return mtx_map[lock].locked;
 }
 
+void init_rwlock(struct RWLock *lock)
+{
+    rw_map.try_add(lock);
+}
+
+void acquire_read_lock(struct RWLock *lock)
+{
+    if (holding++ == 0)
+        blocker.p();
+    rw_map[lock].lock_shared();
+}
+
+void release_read_lock(struct RWLock *lock)
+{
+    rw_map[lock].unlock_shared();
+    if (--holding == 0)
+        blocker.v();
+}
+
+void acquire_write_lock(struct RWLock *lock)
+{
+    if (holding++ == 0)
+        blocker.p();
+    rw_map[lock].lock();
+}
+
+void release_write_lock(struct RWLock *lock)
+{
+    rw_map[lock].unlock();
+    if (--holding == 0)
+        blocker.v();
+}
+
 struct Semaphore;
 #define sa(x) ((uint64_t *)x)[0]
 #define sb(x) ((uint64_t *)x)[1]
@@ -174,4 +214,28 @@ int post_all_sem(Semaphore *x)
 }
 #undef sa
 #undef sb
+
+// host threads have no scheduler state to spin on, so a mutex is just a
+// semaphore. It is kept in `sleep_map`, like the RWLocks, and the kernel
+// Mutex struct is left alone.
+static Semaphore *mutex_sem(void *x)
+{
+    return (Semaphore *)sleep_map[x].sem;
+}
+void init_mutex(void *x)
+{
+    sleep_map.try_add(x);
+    init_sem(mutex_sem(x), 1);
+}
+bool _acquire_mutex(void *x, bool alertable)
+{
+    _lock_sem(mutex_sem(x));
+    return _wait_sem(mutex_sem(x), alertable);
+}
+void release_mutex(void *x)
+{
+    _lock_sem(mutex_sem(x));
+    _post_sem(mutex_sem(x));
+    _unlock_sem(mutex_sem(x));
+}
 }
@@ -1,5 +1,6 @@
 #include <aarch64/intrinsic.h>
 #include <kernel/cpu.h>
+#include <kernel/mem.h>
 #include <kernel/printk.h>
 #include <kernel/sched.h>
 #include <kernel/proc.h>
@@ -15,6 +16,7 @@ NO_RETURN void idle_entry()
         yield();
         if (panic_flag)
             break;
+        refill_zeroed_pages();
         arch_with_trap
         {
             arch_wfi();
@@ -36,6 +38,7 @@ NO_RETURN void kernel_entry()
     // pgfault_first_test();
     // printk("Starting 2nd pgfault test.");
     // pgfault_second_test();
+    // pgfault_cow_test();
     // printk("Pgfault test over.");
 
     // proc_test();
@@ -21,12 +21,15 @@ static bool __timer_cmp(rb_node lnode, rb_node rnode)
 
 static void __timer_set_clock()
 {
-    auto node = _rb_first(&cpus[cpuid()].timer);
+    auto c = &cpus[cpuid()];
+    acquire_spinlock(&c->timer_lock);
+    auto node = _rb_first(&c->timer);
+    u64 t1 = node ? container_of(node, struct timer, _node)->_key : 0;
+    release_spinlock(&c->timer_lock);
     if (!node) {
         reset_clock(10);
         return;
     }
-    auto t1 = container_of(node, struct timer, _node)->_key;
     auto t0 = get_timestamp_ms();
     if (t1 <= t0)
         reset_clock(0);
@@ -36,16 +39,22 @@ static void __timer_set_clock()
 
 static void timer_clock_handler()
 {
+    auto c = &cpus[cpuid()];
     reset_clock(10);
     while (1) {
-        auto node = _rb_first(&cpus[cpuid()].timer);
-        if (!node)
+        acquire_spinlock(&c->timer_lock);
+        auto node = _rb_first(&c->timer);
+        auto timer = node ? container_of(node, struct timer, _node) : NULL;
+        if (!timer || get_timestamp_ms() < timer->_key) {
+            release_spinlock(&c->timer_lock);
             break;
-        auto timer = container_of(node, struct timer, _node);
-        if (get_timestamp_ms() < timer->_key)
-            break;
-        cancel_cpu_timer(timer);
+        }
+        _rb_erase(&timer->_node, &c->timer);
         timer->triggered = true;
+        release_spinlock(&c->timer_lock);
+        __timer_set_clock();
+        // the handler may switch to another process, so it runs without
+        // the lock.
         timer->handler(timer);
     }
 }
@@ -66,17 +75,33 @@ static void hello(struct timer *t)
 
 void set_cpu_timer(struct timer *timer)
 {
+    auto c = &cpus[cpuid()];
+    acquire_spinlock(&c->timer_lock);
     timer->triggered = false;
+    timer->_cpu = cpuid();
     timer->_key = get_timestamp_ms() + timer->elapse;
-    ASSERT(0 == _rb_insert(&timer->_node, &cpus[cpuid()].timer, __timer_cmp));
+    ASSERT(0 == _rb_insert(&timer->_node, &c->timer, __timer_cmp));
+    release_spinlock(&c->timer_lock);
     __timer_set_clock();
 }
 
+bool try_cancel_cpu_timer(struct timer *timer)
+{
+    auto c = &cpus[timer->_cpu];
+    acquire_spinlock(&c->timer_lock);
+    bool pending = !timer->triggered;
+    if (pending)
+        _rb_erase(&timer->_node, &c->timer);
+    release_spinlock(&c->timer_lock);
+    // the clock of another CPU just fires early and finds nothing to do.
+    if (timer->_cpu == (int)cpuid())
+        __timer_set_clock();
+    return pending;
+}
+
 void cancel_cpu_timer(struct timer *timer)
 {
-    ASSERT(!timer->triggered);
-    _rb_erase(&timer->_node, &cpus[cpuid()].timer);
-    __timer_set_clock();
+    ASSERT(try_cancel_cpu_timer(timer));
 }
 
 void set_cpu_on()
@@ -2,17 +2,47 @@
 
 #include <kernel/proc.h>
 #include <common/rbtree.h>
+#include <common/bitmap.h>
 
 #define NCPU 4
 
+/**
+ * The per-CPU scheduler state. The run queue holds only the RUNNABLE procs
+ * waiting for this CPU; the running proc is `this` and is not in it.
+ * Procs with a fixed priority wait in `rt_rq`, one FIFO list per priority,
+ * and run before the fair procs in `rq`, which are ordered by virtual
+ * runtime. Finding the next proc takes constant time: the first bit of
+ * `rt_ready`, or the cached `leftmost`.
+ *
+ * `lock` protects `rq` and the state of every proc whose `schinfo.cpu` is
+ * this CPU. A CPU only takes its own lock to switch, so switches on
+ * different CPUs do not contend. The lock is held across the switch and
+ * released by the proc switched to.
+ */
 struct sched {
-    // TODO: customize your sched info
     Proc *this, *idle;
+    SpinLock lock;
+    ListNode rt_rq[SCHED_RT_PRIOS];
+    // bit i is set if `rt_rq[i]` is not empty. Priority SCHED_RT_PRIOS is
+    // bit 0, so the first set bit is the highest priority.
+    Bitmap(rt_ready, SCHED_RT_PRIOS);
+    struct rb_root_ rq;
+    // the fair proc with the least vruntime, NULL if `rq` is empty.
+    rb_node leftmost;
+    // sum of the weights of the procs in `rq`.
+    u64 load;
+    // never decreases. Procs joining `rq` start near it.
+    u64 min_vruntime;
+    // number of procs in `rt_rq` and `rq`, read without the lock by CPUs
+    // looking for work.
+    int nr_ready;
 };
 
 struct cpu {
     bool online;
     struct rb_root_ timer;
+    // protects `timer`, which other CPUs touch to cancel their timers.
+    SpinLock timer_lock;
     struct sched sched;
 };
 
@@ -22,6 +52,8 @@ struct timer {
     bool triggered;
     int elapse;
     u64 _key;
+    // the CPU whose tree holds the timer.
+    int _cpu;
     struct rb_node_ _node;
     void (*handler)(struct timer *);
     u64 data;
@@ -33,4 +65,7 @@ void set_cpu_on();
 void set_cpu_off();
 
 void set_cpu_timer(struct timer *timer);
-void cancel_cpu_timer(struct timer *timer);
\ No newline at end of file
+void cancel_cpu_timer(struct timer *timer);
+// cancel a timer that may fire on another CPU. Return false if it has
+// fired already; its handler may still be running then.
+WARN_RESULT bool try_cancel_cpu_timer(struct timer *timer);
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include <aarch64/intrinsic.h>
 #include <aarch64/mmu.h>
 #include <common/rc.h>
 #include <common/spinlock.h>
@@ -5,143 +6,497 @@
 #include <kernel/mem.h>
 #include <common/list.h>
 #include <kernel/printk.h>
+#include <kernel/cpu.h>
+#include <kernel/slab.h>
 #include <common/string.h>
+#include <common/percpu_counter.h>
 
-RefCount kalloc_page_cnt;
+// number of pages a per-CPU magazine can hold.
+#define PAGE_MAG_SIZE 64
+// number of pages moved between a magazine and the global pool at once.
+#define PAGE_MAG_BATCH (PAGE_MAG_SIZE / 2)
 
-typedef struct MemoryBlock
-{
-    u32 nxt;
-    u32 size;
-} MemBlock;
+/**
+ * Per-CPU page magazine in front of the global page pool.
+ *
+ * Only the owning CPU touches its magazine and traps are disabled in the
+ * kernel, so the fast path needs no lock. An empty magazine is refilled from
+ * `page_depot`, and an overflowing one drained into it, without locks either.
+ */
+struct page_magazine {
+    usize count;
+    void *pages[PAGE_MAG_SIZE];
+} CACHE_ALIGNED;
 
-MemBlock* get(u32 x) { return (MemBlock*)P2K(x); }
-MemBlock* getv(void* x) { return (MemBlock*)x; }
+static struct page_magazine magazines[NCPU];
 
-void insert(MemBlock *h, MemBlock *n) 
-{
-    n->nxt = h->nxt;
-    h->nxt = K2P(n);
-}
+// number of pages handed out and not returned yet.
+static PercpuCounter page_count;
+_Static_assert(PERCPU_COUNTER_SLOTS >= NCPU, "too few counter slots");
+
+static void init_size_classes();
+
+// max number of pages in the zero pool.
+#define ZERO_POOL_SIZE 256
+// number of pages an idle CPU zeroes before checking for work again.
+#define ZERO_POOL_BATCH 8
+// idle CPUs stop refilling the zero pool when fewer pages are left.
+#define ZERO_POOL_RESERVE 1024
+
+/**
+ * Pages zeroed in advance by idle CPUs, for `kalloc_zeroed_page`.
+ *
+ * Pages in the pool are taken from the page allocator, so they keep
+ * `ref == 1`. They are not counted as used by `kalloc_page_count`.
+ */
+static struct {
+    SpinLock lock;
+    usize count;
+    void *pages[ZERO_POOL_SIZE];
+} zero_pool;
 
-const u64 offset = sizeof(MemBlock);
 u64 maxpage;
-void* const nullptr = (void*)P2K(NULL);
 extern char end[], edata[];
-void *top, *zero_page;
+void *zero_page;
+
+SpinLock page_lock;
+
+// pass magazine batches through `page_depot`. Build with -DPAGE_DEPOT=0
+// to take `page_lock` for every batch instead, as before the depot, e.g. to
+// compare the two with `kalloc_test` and `kalloc_bench`.
+#ifndef PAGE_DEPOT
+#define PAGE_DEPOT 1
+#endif
 
-MemBlock mems;
-SpinLock page_lock, alloc_lock;
-MemBlock pages, *pt = &pages;
+/**
+ * Lock-free depot of free single pages between the magazines and the buddy
+ * allocator, linked through the pages themselves.
+ *
+ * Magazines drain into the depot and refill from it without taking
+ * `page_lock`. Only when the depot runs dry do we go to the buddy allocator,
+ * and pages in the depot are merged back into the buddy allocator when a
+ * multi-page allocation fails.
+ */
+static TaggedQueue page_depot;
+
+// the largest number of pages in use seen so far. It is sampled whenever
+// pages leave the global pool, so it may be off by a magazine batch.
+static isize peak_pages;
+
+static void _update_peak() {
+    isize used = kalloc_page_count();
+    isize peak = __atomic_load_n(&peak_pages, __ATOMIC_RELAXED);
+    while (used > peak &&
+           !__atomic_compare_exchange_n(&peak_pages, &peak, used, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+struct page *mem_map;
+
+/**
+ * Buddy allocator for physical pages.
+ *
+ * A free block of 2^k pages is linked into `free_area[k]` through a
+ * `ListNode` stored in its first page, and its head page descriptor is
+ * marked with `PG_BUDDY` and `order == k`.
+ *
+ * Everything here is protected by `page_lock`.
+ */
+static ListNode free_area[MAX_ORDER];
+static usize first_free_pfn; // the first page managed by the buddy allocator.
+
+static void _buddy_push(struct page *page, int order) {
+    page->flags = PG_BUDDY;
+    page->order = order;
+    _insert_into_list(&free_area[order], (ListNode*)page_to_virt(page));
+}
+
+// allocate a block of 2^order pages. Call with `page_lock`.
+static void *_buddy_alloc(int order) {
+    int k = order;
+    while (k < MAX_ORDER && _empty_list(&free_area[k]))
+        k++;
+    if (k == MAX_ORDER)
+        return NULL;
+    ListNode *node = free_area[k].next;
+    _detach_from_list(node);
+    struct page *page = virt_to_page(node);
+    while (k > order) {
+        k--;
+        _buddy_push(page + BIT(k), k);
+    }
+    page->flags = 0;
+    page->order = order;
+    return node;
+}
+
+// free a block of 2^order pages and merge it with its buddies. Call with
+// `page_lock`.
+static void _buddy_free(void *p, int order) {
+    u64 pfn = page_to_pfn(virt_to_page(p));
+    ASSERT(pfn >= first_free_pfn && pfn < FIRST_PFN + NR_PAGES);
+    ASSERT(!(pfn_to_page(pfn)->flags & (PG_BUDDY | PG_RESERVED)));
+    while (order < MAX_ORDER - 1) {
+        u64 buddy = pfn ^ BIT(order);
+        if (buddy < first_free_pfn || buddy >= FIRST_PFN + NR_PAGES)
+            break;
+        struct page *bp = pfn_to_page(buddy);
+        if (!(bp->flags & PG_BUDDY) || bp->order != (u32)order)
+            break;
+        _detach_from_list((ListNode*)page_to_virt(bp));
+        bp->flags = 0;
+        pfn = MIN(pfn, buddy);
+        order++;
+    }
+    _buddy_push(pfn_to_page(pfn), order);
+}
 
 void kinit() {
-    init_rc(&kalloc_page_cnt);
-    init_spinlock(&alloc_lock);
     init_spinlock(&page_lock);
-    pages.nxt = NULL;
+    init_percpu_counter(&page_count, 0);
+    init_spinlock(&zero_pool.lock);
+    init_tagged_queue(&page_depot);
     zero_page = end + (4096 - (((u64)end) & 4095));
-    memset(zero_page, 0, PAGE_SIZE);
-    top = zero_page + PAGE_SIZE;
-    mems.nxt = NULL;
-    maxpage = (P2K(PHYSTOP) - PAGE_BASE(top)) / PAGE_SIZE;
+    clear_page(zero_page);
+
+    // the page descriptors live right after the zero page.
+    mem_map = zero_page + PAGE_SIZE;
+    memset(mem_map, 0, NR_PAGES * sizeof(struct page));
+    first_free_pfn = K2P(round_up((u64)(mem_map + NR_PAGES), PAGE_SIZE)) / PAGE_SIZE;
+    maxpage = FIRST_PFN + NR_PAGES - first_free_pfn;
+
+    for (u64 pfn = FIRST_PFN; pfn < first_free_pfn; ++pfn)
+        pfn_to_page(pfn)->flags = PG_RESERVED;
+    for (int i = 0; i < MAX_ORDER; ++i)
+        init_list_node(&free_area[i]);
+    for (u64 pfn = first_free_pfn; pfn < FIRST_PFN + NR_PAGES;) {
+        int order = MAX_ORDER - 1;
+        while (pfn % BIT(order) || pfn + BIT(order) > FIRST_PFN + NR_PAGES)
+            order--;
+        _buddy_push(pfn_to_page(pfn), order);
+        pfn += BIT(order);
+    }
+
+    init_size_classes();
+    init_vmalloc();
 }
 
-void* kalloc_page() {
-    acquire_spinlock(&page_lock);
-    increment_rc(&kalloc_page_cnt);
-    MemBlock *p = get(pages.nxt);
-    if(p == nullptr) {
-        p = top;
-        p->size = PAGE_SIZE;
-        p->nxt = NULL;
-        top += PAGE_SIZE;
-    } else {
-        pages.nxt = p->nxt;
+// take at most `n` pages from the global pool.
+static usize _pool_take(void **out, usize n) {
+    usize i = 0;
+#if PAGE_DEPOT
+    for (; i < n; ++i) {
+        if ((out[i] = fetch_from_tagged_queue(&page_depot)) == NULL)
+            break;
     }
+#endif
+    if (i < n) {
+        acquire_spinlock(&page_lock);
+        for (; i < n; ++i) {
+            if ((out[i] = _buddy_alloc(0)) == NULL)
+                break;
+        }
+        release_spinlock(&page_lock);
+    }
+    return i;
+}
+
+// give `n` pages back to the global pool.
+static void _pool_put(void **in, usize n) {
+#if PAGE_DEPOT
+    for (usize i = 0; i < n; ++i)
+        add_to_tagged_queue(&page_depot, in[i]);
+#else
+    acquire_spinlock(&page_lock);
+    for (usize i = 0; i < n; ++i)
+        _buddy_free(in[i], 0);
     release_spinlock(&page_lock);
+#endif
+}
+
+// give all pages in the depot back to the buddy allocator. Call with
+// `page_lock`.
+static bool _depot_flush() {
+    QueueNode *node = fetch_all_from_tagged_queue(&page_depot);
+    bool flushed = node != NULL;
+    while (node != NULL) {
+        QueueNode *next = node->next;
+        _buddy_free(node, 0);
+        node = next;
+    }
+    return flushed;
+}
+
+// take a page from the zero pool when the page allocator is exhausted.
+static void *_zero_pool_take() {
+    acquire_spinlock(&zero_pool.lock);
+    void *p = zero_pool.count > 0 ? zero_pool.pages[--zero_pool.count] : NULL;
+    release_spinlock(&zero_pool.lock);
+    return p;
+}
+
+void* kalloc_page() {
+    auto mag = &magazines[cpuid()];
+    if (mag->count == 0) {
+        mag->count = _pool_take(mag->pages, PAGE_MAG_BATCH);
+        if (mag->count == 0)
+            return _zero_pool_take();
+        _update_peak();
+    }
+    void *p = mag->pages[--mag->count];
+    percpu_counter_inc(&page_count);
     ASSERT((u64)p % PAGE_SIZE == 0);
-    return (void*)(p);
+    struct page *page = virt_to_page(p);
+    page->flags = 0;
+    page->ref.count = 1;
+    return p;
 }
 
 void kfree_page(void* p) {
+    if (p == NULL)
+        return;
+    ASSERT((u64)p % PAGE_SIZE == 0);
+    put_page(virt_to_page(p));
+}
+
+void get_page(struct page *page) {
+    if (!(page->flags & PG_RESERVED))
+        increment_rc(&page->ref);
+}
+
+void put_page(struct page *page) {
+    if (page->flags & PG_RESERVED)
+        return;
+    if (!decrement_rc(&page->ref))
+        return;
+    ASSERT(page->ref.count == 0);
+    auto mag = &magazines[cpuid()];
+    if (mag->count == PAGE_MAG_SIZE) {
+        mag->count -= PAGE_MAG_BATCH;
+        _pool_put(mag->pages + mag->count, PAGE_MAG_BATCH);
+    }
+    mag->pages[mag->count++] = page_to_virt(page);
+    percpu_counter_dec(&page_count);
+}
+
+void* kalloc_pages(int order) {
+    ASSERT(order >= 0 && order < MAX_ORDER);
+    acquire_spinlock(&page_lock);
+    void *p = _buddy_alloc(order);
+    // single pages parked in the depot may merge into a block large enough.
+    if (p == NULL && _depot_flush())
+        p = _buddy_alloc(order);
+    release_spinlock(&page_lock);
+    if (p != NULL) {
+        virt_to_page(p)->ref.count = 1;
+        percpu_counter_add(&page_count, BIT(order));
+        _update_peak();
+    }
+    return p;
+}
+
+void kfree_pages(void* p, int order) {
+    if (p == NULL)
+        return;
+    ASSERT(order >= 0 && order < MAX_ORDER);
+    ASSERT((u64)p % (PAGE_SIZE << order) == 0);
+    virt_to_page(p)->ref.count = 0;
     acquire_spinlock(&page_lock);
-    decrement_rc(&kalloc_page_cnt);
-    // pt->nxt = (u64)p;
-    // pt = (MemBlock*)P2K(p);
-    // pt->nxt = NULL;
-    // pt->size = PAGE_SIZE;
-    // printk("free: %p\n", p);
+    _buddy_free(p, order);
     release_spinlock(&page_lock);
-    return;
+    percpu_counter_add(&page_count, -(isize)BIT(order));
 }
 
-void* kalloc(unsigned long long sz) {
-    acquire_spinlock(&alloc_lock);
-    sz += offset + ((8 - (sz & 7)) & 7);
-    MemBlock *p = get(mems.nxt), *lst = &mems;
-    while(p != nullptr) {
-        if(p->size >= sz) {
-            break;
+isize kalloc_page_count() {
+    // pages waiting in the zero pool are not in use.
+    return percpu_counter_sum(&page_count) - (isize)__atomic_load_n(&zero_pool.count, __ATOMIC_RELAXED);
+}
+
+void* kalloc_zeroed_page() {
+    void *p = _zero_pool_take();
+    if (p != NULL)
+        return p;
+    p = kalloc_page();
+    if (p != NULL)
+        clear_page(p);
+    return p;
+}
+
+void refill_zeroed_pages() {
+    for (int i = 0; i < ZERO_POOL_BATCH; ++i) {
+        if (__atomic_load_n(&zero_pool.count, __ATOMIC_RELAXED) >= ZERO_POOL_SIZE
+            || left_page_cnt() < ZERO_POOL_RESERVE)
+            return;
+        void *p = kalloc_page();
+        if (p == NULL)
+            return;
+        clear_page(p);
+        acquire_spinlock(&zero_pool.lock);
+        bool full = zero_pool.count == ZERO_POOL_SIZE;
+        if (!full)
+            zero_pool.pages[zero_pool.count++] = p;
+        release_spinlock(&zero_pool.lock);
+        if (full) {
+            kfree_page(p);
+            return;
         }
-        lst = p;
-        p = get(p->nxt); 
     }
-    if(p == nullptr) {
-        p = (MemBlock*)(kalloc_page());
-        p->nxt = NULL;
-        p->size = PAGE_SIZE;
-        insert(lst, p);
+}
+
+/**
+ * `kalloc` size classes. Each class is served by its own slab cache. The
+ * sizes are chosen so that a slab page is used up with little waste.
+ * Larger requests get whole pages from the buddy allocator.
+ */
+static const usize size_class[] = {
+    8, 16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 672, 1008, KMEM_MAX_SIZE,
+};
+#define NR_SIZE_CLASS (sizeof(size_class) / sizeof(size_class[0]))
+
+static KmemCache size_cache[NR_SIZE_CLASS];
+// size class of every 8-byte step, so that `kalloc` needs no search.
+static u8 size_index[KMEM_MAX_SIZE / 8 + 1];
+
+static void init_size_classes() {
+    kmem_init();
+    for (usize i = 0, c = 0; i <= KMEM_MAX_SIZE / 8; ++i) {
+        while (size_class[c] < i * 8)
+            c++;
+        size_index[i] = c;
     }
-    if(p->size > sz + offset) {
-        MemBlock *p2 = p + sz / 8;
-        p2->size = p->size - sz;
-        p->size = sz;
-        p2->nxt = p->nxt;
-        lst->nxt = K2P(p2);
-    } else {
-        lst->nxt = p->nxt;
+    for (usize c = 0; c < NR_SIZE_CLASS; ++c)
+        init_kmem_cache(&size_cache[c], "kalloc", size_class[c], 8,
+                        KMEM_TAGGED, NULL);
+}
+
+/**
+ * `kalloc` call sites. Every object remembers the index of the site that
+ * allocated it in its slab tag (or in its `struct page` for multi-page
+ * objects), so that frees are charged to the right site. Site 0 collects
+ * everything that does not fit into the table.
+ */
+#define KALLOC_NR_SITES 256
+
+static void *site_ip[KALLOC_NR_SITES];
+
+struct kalloc_site_stat {
+    u64 allocs, frees;
+    // bytes taken from the allocator by live objects, including slack.
+    isize bytes;
+};
+
+// per-CPU so that counting needs neither locks nor atomics.
+static struct {
+    struct kalloc_site_stat site[KALLOC_NR_SITES];
+} CACHE_ALIGNED kalloc_stats[NCPU];
+
+static u8 _site_tag(void *ip) {
+    usize h = (u64)ip * 0x9E3779B97F4A7C15ull >> 56;
+    for (usize i = 0; i < KALLOC_NR_SITES; ++i) {
+        usize t = (h + i) % KALLOC_NR_SITES;
+        if (t == 0)
+            continue;
+        void *cur = __atomic_load_n(&site_ip[t], __ATOMIC_RELAXED);
+        if (cur == NULL &&
+            __atomic_compare_exchange_n(&site_ip[t], &cur, ip, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return t;
+        if (cur == ip)
+            return t;
+    }
+    return 0;
+}
+
+static void _site_charge(u8 tag, isize bytes) {
+    auto stat = &kalloc_stats[cpuid()].site[tag];
+    if (bytes > 0)
+        stat->allocs++;
+    else
+        stat->frees++;
+    stat->bytes += bytes;
+}
+
+void* kalloc(unsigned long long sz) {
+    u8 tag = _site_tag(__builtin_return_address(0));
+    if (sz <= KMEM_MAX_SIZE) {
+        auto cache = &size_cache[size_index[(sz + 7) / 8]];
+        void *p = kmem_cache_alloc(cache);
+        if (p != NULL) {
+            kmem_cache_set_tag(cache, p, tag);
+            _site_charge(tag, cache->size);
+        }
+        return p;
+    }
+    int order = 0;
+    while ((u64)PAGE_SIZE << order < sz)
+        order++;
+    if (order >= MAX_ORDER)
+        return NULL;
+    void *p = kalloc_pages(order);
+    if (p != NULL) {
+        virt_to_page(p)->tag = tag;
+        _site_charge(tag, PAGE_SIZE << order);
     }
-    p->nxt = NULL;
-    release_spinlock(&alloc_lock);
-    return (void*)(p + 1);
+    return p;
 }
 
 void kfree(void* ptr) {
-    acquire_spinlock(&alloc_lock);
-    MemBlock *pt = (MemBlock*)(ptr);
-    --pt;
-    pt->nxt = NULL;
-    if(mems.nxt == NULL) {
-        insert(&mems, pt);
-    } else {
-        MemBlock *p = get(mems.nxt);
-        while(p->nxt != NULL && get(p->nxt) < pt) {
-            p = get(p->nxt);
+    if (ptr == NULL)
+        return;
+    // slab objects never start a page, so a page-aligned pointer is a
+    // multi-page allocation whose order is kept by the buddy allocator.
+    if ((u64)ptr % PAGE_SIZE == 0) {
+        struct page *page = virt_to_page(ptr);
+        _site_charge(page->tag, -(isize)(PAGE_SIZE << page->order));
+        kfree_pages(ptr, page->order);
+        return;
+    }
+    auto cache = kmem_cache_of(ptr);
+    _site_charge(kmem_cache_get_tag(cache, ptr), -(isize)cache->size);
+    kmem_cache_free(cache, ptr);
+}
+
+void kalloc_dump_stats() {
+    usize nr_free[MAX_ORDER], free = 0, largest = 0;
+    acquire_spinlock(&page_lock);
+    for (int k = 0; k < MAX_ORDER; ++k) {
+        nr_free[k] = 0;
+        _for_in_list(node, &free_area[k]) {
+            if (node != &free_area[k])
+                nr_free[k]++;
         }
-        if(p + p->size / 8 == pt) {
-            p->size += pt->size;
-            while(p != nullptr && p->nxt) {
-                if(get(p->nxt) == p + p->size / 8) {
-                    p->size += get(p->nxt)->size;
-                    p->nxt = get(p->nxt)->nxt;
-                } else {
-                    p = get(p->nxt); 
-                }
-            }
-        } else {
-            insert(p, pt);
-            p = pt;
-            while(p != nullptr && p->nxt) {
-                if(get(p->nxt) == p + p->size / 8) {
-                    p->size += get(p->nxt)->size;
-                    p->nxt = get(p->nxt)->nxt;
-                } else {
-                    p = get(p->nxt); 
-                }
-            }
-        }        
-    }
-    release_spinlock(&alloc_lock);
+        free += nr_free[k] << k;
+        if (nr_free[k])
+            largest = BIT(k);
+    }
+    release_spinlock(&page_lock);
+
+    printk("pages: total %llu used %lld peak %lld\n", maxpage,
+           kalloc_page_count(), __atomic_load_n(&peak_pages, __ATOMIC_RELAXED));
+    printk("buddy free blocks by order:");
+    for (int k = 0; k < MAX_ORDER; ++k)
+        printk(" %llu", nr_free[k]);
+    // the part of free buddy memory that cannot serve the largest request
+    // it could serve if it were contiguous.
+    printk("\nfragmentation: %llu%%\n", free ? 100 - largest * 100 / free : 0);
+
+    kmem_dump_stats();
+
+    printk("site: live bytes allocs frees\n");
+    for (usize t = 0; t < KALLOC_NR_SITES; ++t) {
+        struct kalloc_site_stat sum = {0, 0, 0};
+        for (int i = 0; i < NCPU; ++i) {
+            auto stat = &kalloc_stats[i].site[t];
+            sum.allocs += __atomic_load_n(&stat->allocs, __ATOMIC_RELAXED);
+            sum.frees += __atomic_load_n(&stat->frees, __ATOMIC_RELAXED);
+            sum.bytes += __atomic_load_n(&stat->bytes, __ATOMIC_RELAXED);
+        }
+        if (sum.allocs == 0)
+            continue;
+        printk("%p: %llu %lld %llu %llu\n", site_ip[t], sum.allocs - sum.frees,
+               sum.bytes, sum.allocs, sum.frees);
+    }
 }
 
 void* get_zero_page() {
@@ -149,5 +504,5 @@ void* get_zero_page() {
 }
 
 u64 left_page_cnt(){
-    return maxpage - kalloc_page_cnt.count;
+    return maxpage - kalloc_page_count();
 }
@@ -3,20 +3,122 @@
 #include <common/defines.h>
 #include <common/list.h>
 #include <common/rc.h>
+#include <driver/memlayout.h>
 
 #define PAGE_COUNT ((P2K(PHYSTOP) - PAGE_BASE((u64) & end)) / PAGE_SIZE - 1)
 
+// the largest block the buddy allocator hands out is 2^(MAX_ORDER-1) pages.
+#define MAX_ORDER 11
+
+// page flags.
+#define PG_DIRTY BIT(0) // the content differs from its backing store.
+#define PG_LOCKED BIT(1) // someone is doing I/O or changing the mapping.
+#define PG_COW BIT(2) // shared read-only by `vm_copy`, copy on the next write.
+#define PG_PAGECACHE BIT(3) // owned by the page cache.
+#define PG_BUDDY BIT(4) // the head of a free block in the buddy allocator.
+#define PG_RESERVED BIT(5) // kernel image and allocator metadata.
+
+/**
+ * Page frame descriptor. There is one for every physical page of RAM in
+ * `mem_map`, indexed by PFN.
+ *
+ * `ref` counts the users of an allocated page: `kalloc_page` returns a page
+ * with `ref == 1`, `get_page` adds a user and `put_page`/`kfree_page` drops
+ * one. The page goes back to the allocator when the last user is gone.
+ *
+ * `order` is only meaningful for the head page of a block, where it is the
+ * block size (2^order pages) in the buddy allocator. `tag` is the allocation
+ * site of a block allocated by `kalloc`.
+ */
 struct page {
     RefCount ref;
+    u32 flags;
+    u16 order;
+    u8 tag;
 };
 
+#define FIRST_PFN (EXTMEM / PAGE_SIZE)
+#define NR_PAGES ((PHYSTOP - EXTMEM) / PAGE_SIZE)
+
+extern struct page *mem_map;
+
+static INLINE u64 page_to_pfn(struct page *page)
+{
+    return (u64)(page - mem_map) + FIRST_PFN;
+}
+
+static INLINE struct page *pfn_to_page(u64 pfn)
+{
+    return &mem_map[pfn - FIRST_PFN];
+}
+
+static INLINE struct page *virt_to_page(void *ka)
+{
+    return pfn_to_page(K2P(ka) / PAGE_SIZE);
+}
+
+static INLINE void *page_to_virt(struct page *page)
+{
+    return (void *)P2K(page_to_pfn(page) * PAGE_SIZE);
+}
+
+static INLINE bool page_test_flag(struct page *page, u32 flag)
+{
+    return (__atomic_load_n(&page->flags, __ATOMIC_ACQUIRE) & flag) != 0;
+}
+
+static INLINE void page_set_flag(struct page *page, u32 flag)
+{
+    __atomic_fetch_or(&page->flags, flag, __ATOMIC_ACQ_REL);
+}
+
+static INLINE void page_clear_flag(struct page *page, u32 flag)
+{
+    __atomic_fetch_and(&page->flags, ~flag, __ATOMIC_ACQ_REL);
+}
+
+// set `flag` and return whether it was already set.
+static INLINE bool page_test_and_set_flag(struct page *page, u32 flag)
+{
+    return (__atomic_fetch_or(&page->flags, flag, __ATOMIC_ACQ_REL) & flag) != 0;
+}
+
+void get_page(struct page *page);
+void put_page(struct page *page);
+
 void kinit();
 u64 left_page_cnt();
+isize kalloc_page_count();
 
 WARN_RESULT void *kalloc_page();
 void kfree_page(void *);
 
+// allocate a page filled with zeros, preferably from the pool of pages
+// zeroed by idle CPUs.
+WARN_RESULT void *kalloc_zeroed_page();
+// zero a few pages in advance. Called by idle CPUs.
+void refill_zeroed_pages();
+
+// allocate/free 2^order physically contiguous pages, aligned to their size.
+WARN_RESULT void *kalloc_pages(int order);
+void kfree_pages(void *, int order);
+
 WARN_RESULT void *kalloc(unsigned long long);
 void kfree(void *);
 
+// the kernel virtual range used by `kvalloc`: level-0 entry 1 of the kernel
+// page table.
+#define VMALLOC_START (KSPACE_MASK + BIT(39))
+#define VMALLOC_SIZE BIT(30)
+
+void init_vmalloc();
+// allocate `size` bytes of zeroed, virtually contiguous memory. The pages
+// behind it are not physically contiguous, so it must not be used for DMA.
+WARN_RESULT void *kvalloc(usize size);
+void kvfree(void *);
+
+// print page usage, fragmentation and `kalloc` statistics per size class
+// and per call site.
+void kalloc_dump_stats();
+
 WARN_RESULT void *get_zero_page();
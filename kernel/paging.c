@@ -82,6 +82,32 @@ u64 sbrk(i64 size) {
 //     release_sleeplock(&swaplock);
 // }
 
+/**
+ * Give the read-only mapping `pte` a page that it may write: take the page
+ * over if nobody else maps it, or copy it otherwise. The caller flushes
+ * the TLB.
+ *
+ * Return false and leave `pte` as it is if there is no memory for the copy.
+ */
+bool cow_break(PTEntriesPtr pte) {
+    void *old = (void*)P2K(PTE_ADDRESS(*pte));
+    struct page *page = virt_to_page(old);
+    if (!page_test_flag(page, PG_RESERVED) && page->ref.count == 1) {
+        // we are the last user of the shared page, take it over.
+        page_clear_flag(page, PG_COW);
+        *pte = K2P(old) | PTE_USER_DATA;
+    } else {
+        auto p = kalloc_page();
+        if (p == NULL) {
+            return false;
+        }
+        copy_page(p, old);
+        kfree_page(old);
+        *pte = K2P(p) | PTE_USER_DATA;
+    }
+    return true;
+}
+
 int pgfault_handler(u64 iss) {
     Proc *p = thisproc();
     struct pgdir *pd = &p->pgdir;
@@ -111,13 +137,14 @@ int pgfault_handler(u64 iss) {
         if (sec->flags & ST_SWAP) {
             // swap(pd, sec);
         } else {
-            *pte = K2P(kalloc_page()) | PTE_USER_DATA;
+            *pte = K2P(kalloc_zeroed_page()) | PTE_USER_DATA;
         }
     } else if (*pte & PTE_RO) {
-        auto p = kalloc_page();
-        kfree_page((void*)P2K(PTE_ADDRESS(*pte)));
-        memmove(p, (void*)P2K(PTE_ADDRESS(*pte)), PAGE_SIZE);
-        *pte = K2P(p) | PTE_USER_DATA;
+        if (!cow_break(pte)) {
+            // out of memory: the trap handler kills it on the way out.
+            p->killed = true;
+            return iss;
+        }
     } else if (!(*pte & PTE_VALID) && (sec->flags & ST_SWAP)) {
         // swap(pd, sec);
     }
@@ -25,6 +25,7 @@ struct section {
 };
 
 int pgfault_handler(u64 iss);
+WARN_RESULT bool cow_break(PTEntriesPtr pte);
 void init_sections(ListNode *section_head);
 void free_sections(struct pgdir *pd);
 void copy_sections(ListNode *from_head, ListNode *to_head);
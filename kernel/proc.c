@@ -2,7 +2,9 @@
 #include <kernel/mem.h>
 #include <kernel/sched.h>
 #include <aarch64/mmu.h>
+#include <common/bitmap.h>
 #include <common/list.h>
+#include <common/rwlock.h>
 #include <common/string.h>
 #include <kernel/printk.h>
 #include <kernel/paging.h>
@@ -13,64 +15,44 @@ Proc root_proc;
 void kernel_entry();
 void proc_entry();
 
-static int pid;
-static SpinLock plock;
+// protects the process tree. Lookups take it for reading.
+static RWLock plock;
+// all procs that have not been reaped yet, by pid.
+static HashTable pid_table;
 static SpinLock listlock;
 
-typedef struct ValList {
-    int val;
-    struct ValList *pre, *nxt;
-} List;
+// max number of pids. Pid 0 is never used, so at most NPID - 1 procs can
+// exist at once; `create_proc` fails after that.
+#define NPID 4096
 
-List freepid;
+// pids in use.
+static Bitmap(pid_map, NPID);
+// where the search for a free pid starts, so that a pid is not handed out
+// again right after it is freed.
+static usize pid_hint;
 static SpinLock pidlock;
 
-void acquire_pidlock() {
+// allocate a pid, or return -1 if all are in use.
+int get_pid() {
     acquire_spinlock(&pidlock);
-}
-void release_pidlock() {
+    usize p = bitmap_find_next_zero(pid_map, NPID, pid_hint);
+    if(p == NPID) {
+        p = bitmap_find_first_zero(pid_map, NPID);
+    }
+    if(p == NPID) {
+        release_spinlock(&pidlock);
+        return -1;
+    }
+    bitmap_set(pid_map, p);
+    pid_hint = p + 1;
     release_spinlock(&pidlock);
-}
-bool list_empty(List* l) {
-    bool r;
-    // acquire_pidlock();
-    r = l->nxt == l;
-    // release_pidlock();
-    return r;
-}
-void list_insert(List *p1, List *p2) {
-    acquire_pidlock();
-    
-    if(!p1 || !p2) return;
-    List *p3 = p1->nxt, *p4 = p2->pre;
-
-    p1->nxt = p2; p2->pre = p1;
-    p4->nxt = p3; p3->pre = p4;
-
-    release_pidlock();
-}
-void list_erase(List *l) {
-    // acquire_pidlock();
-    List *pre = l->pre, *nxt = l->nxt;
-    pre->nxt = nxt;
-    nxt->pre = pre;
-    l->nxt = l->pre = l;
-    kfree(l);
-    // release_pidlock();
+    return p;
 }
 
-int get_pid() {
-    acquire_pidlock();
-    if(list_empty(&freepid)) {
-        int p = ++pid;
-        release_pidlock();
-        return p;
-    } else {
-        int p = freepid.nxt->val;
-        list_erase(freepid.nxt);
-        release_pidlock();
-        return p;
-    }
+static void put_pid(int p) {
+    acquire_spinlock(&pidlock);
+    bitmap_clear(pid_map, p);
+    release_spinlock(&pidlock);
 }
 
 // init_kproc initializes the kernel process
@@ -81,22 +63,28 @@ void init_kproc()
     // 1. init global resources (e.g. locks, semaphores)
     // 2. init the root_proc (finished)
     ASSERT(cpuid() == 0);
-    init_spinlock(&plock);
+    init_rwlock(&plock);
+    init_hashtable(&pid_table, 4);
     init_spinlock(&listlock);
-    freepid.pre = freepid.nxt = &freepid;
-    init_proc(&root_proc);
+    init_spinlock(&pidlock);
+    bitmap_set(pid_map, 0);
+    ASSERT(init_proc(&root_proc));
     root_proc.parent = &root_proc;
     start_proc(&root_proc, kernel_entry, 123456);
 }
 
-void init_proc(Proc *p)
+bool init_proc(Proc *p)
 {
     // TODO:
     // setup the Proc with kstack and pid allocated
     // NOTE: be careful of concurrency
-    acquire_spinlock(&plock);
+    acquire_write_lock(&plock);
     memset(p, 0, sizeof(*p));
     p->pid = get_pid();
+    if(p->pid < 0) {
+        release_write_lock(&plock);
+        return false;
+    }
     p->idle = 0;
     init_sem(&p->childexit, 0);
     init_list_node(&p->children);
@@ -110,14 +98,22 @@ void init_proc(Proc *p)
 
     p->killed = false;
     init_pgdir(&p->pgdir);
+    hashtable_insert(&pid_table, &p->pidnode, p->pid);
 
-    release_spinlock(&plock);
+    release_write_lock(&plock);
+    return true;
 }
 
 Proc *create_proc()
 {
     Proc *p = kalloc(sizeof(Proc));
-    init_proc(p);
+    if(p == NULL) {
+        return NULL;
+    }
+    if(!init_proc(p)) {
+        kfree(p);
+        return NULL;
+    }
     return p;
 }
 
@@ -126,11 +122,11 @@ void set_parent_to_this(Proc *proc)
     // TODO: set the parent of proc to thisproc
     // NOTE: maybe you need to lock the process tree
     // NOTE: it's ensured that the old proc->parent = NULL
-    acquire_spinlock(&plock);
+    acquire_write_lock(&plock);
     ASSERT(proc->parent == NULL);
     proc->parent = thisproc();
     insert_into_list(&listlock, &thisproc()->children, &proc->ptnode);
-    release_spinlock(&plock);
+    release_write_lock(&plock);
 }
 
 int start_proc(Proc *p, void (*entry)(u64), u64 arg)
@@ -140,7 +136,7 @@ int start_proc(Proc *p, void (*entry)(u64), u64 arg)
     // 2. setup the kcontext to make the proc start with proc_entry(entry, arg)
     // 3. activate the proc and return its pid
     // NOTE: be careful of concurrency
-    acquire_spinlock(&plock);
+    acquire_write_lock(&plock);
     if(p->parent == NULL) {
         p->parent = &root_proc;
         insert_into_list(&listlock, &root_proc.children, &p->ptnode);
@@ -150,7 +146,7 @@ int start_proc(Proc *p, void (*entry)(u64), u64 arg)
     p->kcontext->x1 = (u64)arg;
     int id = p->pid;
     activate_proc(p);
-    release_spinlock(&plock);
+    release_write_lock(&plock);
     return id;
 }
 
@@ -161,47 +157,43 @@ int wait(int *exitcode)
     // 2. wait for childexit
     // 3. if any child exits, clean it up and return its pid and exitcode
     // NOTE: be careful of concurrency
-    acquire_spinlock(&plock);
+    acquire_read_lock(&plock);
     auto this = thisproc();
     if(this->children.next == &this->children) {
-        release_spinlock(&plock);
+        release_read_lock(&plock);
         return -1;
     }
-    release_spinlock(&plock);
+    release_read_lock(&plock);
     if(!wait_sem(&this->childexit)) {
         return -1;
     }
-    acquire_spinlock(&plock);
-    acquire_sched_lock();
+    acquire_write_lock(&plock);
     Proc *zombie = NULL;
     _for_in_list(p, &this->children) {
         if(p == &this->children) continue;
         auto childproc = container_of(p, Proc, ptnode);
         ASSERT(childproc->parent == this);
         ASSERT(&childproc->ptnode == p);
-        if (childproc->state == ZOMBIE) {
+        // `is_zombie` waits for the run queue lock the child holds until
+        // it has switched away for the last time.
+        if (is_zombie(childproc)) {
             zombie = childproc;
             break;
         }
     }
     if(zombie != NULL) {
-        ASSERT(zombie->state == ZOMBIE);
+        // a zombie is in no run queue.
         detach_from_list(&listlock, &zombie->ptnode);
-        detach_from_list(&listlock, &zombie->schinfo.rq);
+        hashtable_remove(&pid_table, &zombie->pidnode);
         *exitcode = zombie->exitcode;
         kfree_page(zombie->kstack);
         int npid = zombie->pid;
-        List *l = kalloc(sizeof(List));
-        l->val = npid;
-        l->nxt = l->pre = l;
-        list_insert(&freepid, l);
+        put_pid(npid);
         kfree(zombie);
-        release_sched_lock();
-        release_spinlock(&plock);
+        release_write_lock(&plock);
         return npid;
     }
-    release_sched_lock();
-    release_spinlock(&plock);
+    release_write_lock(&plock);
     return -1;
 }
 
@@ -213,8 +205,7 @@ NO_RETURN void exit(int code)
     // 3. transfer children to the root_proc, and notify the root_proc if there is zombie
     // 4. sched(ZOMBIE)
     // NOTE: be careful of concurrency
-    acquire_spinlock(&plock);
-    acquire_sched_lock();
+    acquire_write_lock(&plock);
 
     auto this = thisproc();
     ASSERT(this != &root_proc);
@@ -225,62 +216,85 @@ NO_RETURN void exit(int code)
         auto childproc = container_of(p, Proc, ptnode);
         ASSERT(childproc->parent == this);
         childproc->parent = &root_proc;
-        if(childproc->state == ZOMBIE) {
+        if(is_zombie(childproc)) {
             ++times;
         } 
     }
     if(!_empty_list(&this->children)) {
         merge_list(&listlock, &root_proc.children, this->children.next);
         detach_from_list(&listlock, &this->children);
-        release_sched_lock();
         for(int i = 0; i < times; ++i) {
             post_sem(&root_proc.childexit);
         }
-        acquire_sched_lock();
     }
     for (int i = 0; i < 16; ++i) {
         if (this->oftable.openfile[i]){
-            release_sched_lock();
-            release_spinlock(&plock);
+            release_write_lock(&plock);
             file_close(this->oftable.openfile[i]);
-            acquire_spinlock(&plock);
-            acquire_sched_lock();
+            acquire_write_lock(&plock);
             this->oftable.openfile[i] = NULL;
         }
     }
-    release_sched_lock();
-    release_spinlock(&plock);
+    release_write_lock(&plock);
     if (this->cwd) {
         inodes.put(NULL, this->cwd);
     }
-    acquire_spinlock(&plock);
-    acquire_sched_lock();
+    acquire_write_lock(&plock);
     free_pgdir(&this->pgdir);
-    release_sched_lock();
     post_sem(&thisproc()->parent->childexit); 
     acquire_sched_lock();
-    release_spinlock(&plock);
+    release_write_lock(&plock);
     sched(ZOMBIE);
     PANIC(); // prevent the warning of 'no_return function returns'
 }
 
-Proc* search(int pid, Proc *cur) 
+// match a proc in the pid index unless it is unused.
+static bool _live_match(HashNode *node, void *arg)
 {
-    if(cur->pid == pid && !is_unused(cur)) {
-        cur->killed = true;
-        return cur;
-    }
-    _for_in_list(p, &cur->children){
-        if(p == &cur->children) {
-            continue;
-        }
-        auto childproc = container_of(p, Proc, ptnode);
-        Proc *ch = search(pid, childproc);
-        if(ch != NULL) {
-            return ch;
-        }
+    (void)arg;
+    return !is_unused(container_of(node, Proc, pidnode));
+}
+
+// the live proc `pid`, or this proc if `pid` is 0. Call with `plock` held
+// for reading, which keeps the proc from being reaped.
+static Proc *_find_proc(int pid)
+{
+    if (pid == 0)
+        return thisproc();
+    HashNode *node = hashtable_find(&pid_table, pid, _live_match, NULL);
+    return node ? container_of(node, Proc, pidnode) : NULL;
+}
+
+int setpriority(int pid, int nice)
+{
+    acquire_read_lock(&plock);
+    Proc *p = _find_proc(pid);
+    if (p != NULL)
+        set_nice(p, nice);
+    release_read_lock(&plock);
+    return p ? 0 : -1;
+}
+
+int setrtprio(int pid, int prio)
+{
+    acquire_read_lock(&plock);
+    Proc *p = _find_proc(pid);
+    if (p != NULL)
+        set_rt_prio(p, prio);
+    release_read_lock(&plock);
+    return p ? 0 : -1;
+}
+
+// mark a proc found in the pid index as killed, unless it is unused.
+static bool _kill_match(HashNode *node, void *arg)
+{
+    (void)arg;
+    auto p = container_of(node, Proc, pidnode);
+    if(is_unused(p)) {
+        return false;
     }
-    return NULL;
+    p->killed = true;
+    return true;
 }
 
 int kill(int pid)
@@ -288,18 +302,18 @@ int kill(int pid)
     // TODO:
     // Set the killed flag of the proc to true and return 0.
     // Return -1 if the pid is invalid (proc not found).
-    acquire_spinlock(&plock);
-    Proc *target = search(pid, &root_proc);
-    release_spinlock(&plock);
-    if(target != NULL) {
-        if(target->ucontext->elr >> 48) {
-            return -1;
-        } else {
-            alert_proc(target);
-            return 0;
-        }
+    // `wait` reaps procs with the tree locked for writing, so the target
+    // stays alive while we hold it for reading.
+    acquire_read_lock(&plock);
+    HashNode *node = hashtable_find(&pid_table, pid, _kill_match, NULL);
+    Proc *target = node ? container_of(node, Proc, pidnode) : NULL;
+    int ret = -1;
+    if(target != NULL && !(target->ucontext->elr >> 48)) {
+        alert_proc(target);
+        ret = 0;
     }
-    return -1;
+    release_read_lock(&plock);
+    return ret;
 }
 /*
  * Create a new process copying p as the parent.
@@ -326,10 +340,10 @@ int fork()
     }
     auto tmp = vm_copy(&cur->pgdir);
     if (tmp == NULL) {
-        kfree(proc->kstack);
-        acquire_spinlock(&plock);
+        kfree_page(proc->kstack);
+        acquire_write_lock(&plock);
         proc->state = UNUSED;
-        release_spinlock(&plock);
+        release_write_lock(&plock);
         return -1;
     }
     proc->pgdir = *tmp;
@@ -343,9 +357,9 @@ int fork()
     }
     proc->cwd = inodes.share(cur->cwd);
     int pid = proc->pid;
-    acquire_spinlock(&plock);
+    acquire_write_lock(&plock);
     insert_into_list(&listlock, &cur->children, &proc->ptnode);
-    release_spinlock(&plock);
+    release_write_lock(&plock);
     start_proc(proc, trap_return, 0);
     return pid;
     /* (Final) TODO END */
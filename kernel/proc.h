@@ -1,6 +1,7 @@
 #pragma once
 
 #include <common/defines.h>
+#include <common/hashtable.h>
 #include <common/list.h>
 #include <common/sem.h>
 #include <common/rbtree.h>
@@ -25,9 +26,25 @@ typedef struct KernelContext {
 } KernelContext;
 
 // embeded data for procs
+// number of fixed priorities, see `set_rt_prio`.
+#define SCHED_RT_PRIOS 32
+
 struct schinfo {
-    // TODO: customize your sched info
-    ListNode rq;
+    // in the run queue of `cpu` while RUNNABLE: the tree of fair procs, or
+    // the FIFO list of the priority `rt_prio`.
+    struct rb_node_ rq;
+    ListNode rt_rq;
+    // 0 for a fair proc, or 1 (lowest) to SCHED_RT_PRIOS.
+    int rt_prio;
+    // the CPU the proc runs or last ran on. Only changed with the locks of
+    // both the old and the new CPU held.
+    int cpu;
+    // from NICE_MIN (most CPU time) to NICE_MAX, see `set_nice`.
+    int nice;
+    // CPU time used in timer ticks, scaled by NICE_0_WEIGHT / weight.
+    u64 vruntime;
+    // when the proc last started running.
+    u64 start;
 };
 
 typedef struct Proc {
@@ -39,6 +56,8 @@ typedef struct Proc {
     Semaphore childexit;
     ListNode children;
     ListNode ptnode;
+    // in the pid index, until the proc is reaped.
+    HashNode pidnode;
     struct Proc *parent;
     struct schinfo schinfo;
     struct pgdir pgdir;
@@ -50,12 +69,18 @@ typedef struct Proc {
 } Proc;
 
 void init_kproc();
-void init_proc(Proc *);
+// return false if no pid is left.
+WARN_RESULT bool init_proc(Proc *);
 WARN_RESULT Proc *create_proc();
 int start_proc(Proc *, void (*entry)(u64), u64 arg);
 NO_RETURN void exit(int code);
 WARN_RESULT int wait(int *exitcode);
 WARN_RESULT int kill(int pid);
+// set the nice value of the proc `pid`, or of this proc if `pid` is 0.
+// Return -1 if there is no such proc.
+int setpriority(int pid, int nice);
+// the same for the fixed priority, see `set_rt_prio`.
+int setrtprio(int pid, int prio);
 WARN_RESULT int fork();
 
 void set_parent_to_this(Proc*);
\ No newline at end of file
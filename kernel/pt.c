@@ -6,9 +6,7 @@
 
 void* new_page() 
 {
-    void *p = kalloc_page();
-    memset(p, 0, PAGE_SIZE);
-    return p;
+    return kalloc_zeroed_page();
 }
 
 PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc)
@@ -42,8 +40,7 @@ PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc)
 
 void init_pgdir(struct pgdir *pgdir)
 {
-    pgdir->pt = kalloc_page();
-    memset(pgdir->pt,0,PAGE_SIZE);
+    pgdir->pt = kalloc_zeroed_page();
     init_spinlock(&pgdir->lock);
     init_list_node(&pgdir->section_head);
     init_sections(&pgdir->section_head);
@@ -107,6 +104,7 @@ int copyout(struct pgdir *pd, void *va, void *p, usize len)
     void *page;
     usize n, pgoff;
     u64 *pte;
+    bool fresh;
     if ((usize)va + len > USERTOP) {
         return -1;
     }
@@ -115,10 +113,11 @@ int copyout(struct pgdir *pd, void *va, void *p, usize len)
         if ((pte = get_pte(pd, (u64)va, 1)) == NULL) {
             return -1;
         }
-        if (*pte & PTE_VALID) {
+        fresh = !(*pte & PTE_VALID);
+        if (!fresh) {
             page = (void*)P2K(PTE_ADDRESS(*pte));
         } else {
-            if ((page = kalloc_page()) == NULL) {
+            if ((page = kalloc_zeroed_page()) == NULL) {
                 return -1;
             }
             *pte = K2P(page) | PTE_USER_DATA;
@@ -127,7 +126,8 @@ int copyout(struct pgdir *pd, void *va, void *p, usize len)
         if (p) {
             memmove(page + pgoff, p, n);
             p += n;
-        } else {
+        } else if (!fresh) {
+            // a new page is already zeroed.
             memset(page + pgoff, 0, n);
         }
     }
@@ -154,11 +154,15 @@ struct pgdir* vm_copy(struct pgdir *pgdir) {
                                 if (pgt3[i3] & PTE_VALID) {
                                     u64 va = (u64)i << (12 + 9 * 3) | (u64) i1 << (12 + 9 * 2) | 
                                              (u64)i2 << (12 + 9) | i3 << 12;
+                                    // share the page read-only; the first
+                                    // write on either side copies it.
                                     u64 pa = PTE_ADDRESS(pgt3[i3]);
-                                    void *np = kalloc_page();
-                                    memmove(np, (void*)P2K(pa), PAGE_SIZE);
+                                    struct page *page = virt_to_page((void*)P2K(pa));
+                                    get_page(page);
+                                    page_set_flag(page, PG_COW);
+                                    pgt3[i3] |= PTE_RO;
                                     auto pte = get_pte(newpgdir, va, true);
-                                    *pte = K2P(np) | PTE_USER_DATA;
+                                    *pte = pgt3[i3];
                                 }
                             }
                         }
@@ -167,6 +171,8 @@ struct pgdir* vm_copy(struct pgdir *pgdir) {
             }
         }
     }
+    // the old mappings just became read-only.
+    arch_tlbi_vmalle1is();
     return newpgdir;
 }
 
@@ -5,15 +5,31 @@
 #include <aarch64/intrinsic.h>
 #include <kernel/cpu.h>
 #include <common/rbtree.h>
+#include <common/percpu_counter.h>
+#include <common/rcu.h>
 
 extern bool panic_flag;
 
 extern void swtch(KernelContext *new_ctx, KernelContext **old_ctx);
 
-static SpinLock rqlock, listlock;
-static ListNode rq;
+// every runnable proc of a CPU runs once in SCHED_LATENCY ms, but for
+// at least SCHED_MIN_SLICE ms at a time.
+#define SCHED_LATENCY 6
+#define SCHED_MIN_SLICE 1
+#define NICE_0_WEIGHT 1024
+
+// the weight of every nice value, as in Linux. One nice level apart is
+// about 10% of CPU time when two procs share a CPU.
+static const u32 nice_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+    1024,  820,   655,   526,   423,   335,   272,   215,   172,   137,
+    110,   87,    70,    56,    45,    36,    29,    23,    18,    15,
+};
 
 static struct timer sched_timer[NCPU];
+// number of switches to another process.
+static PercpuCounter nr_switches;
 static void sched_timer_handler(struct timer*);
 
 void init_sched()
@@ -21,18 +37,24 @@ void init_sched()
     // TODO: initialize the scheduler
     // 1. initialize the resources (e.g. locks, semaphores)
     // 2. initialize the scheduler info of each CPU
-    init_spinlock(&rqlock);
-    init_spinlock(&listlock);
-    init_list_node(&rq);
+    init_percpu_counter(&nr_switches, 0);
     for(int i = 0; i < NCPU; ++i) {
+        init_spinlock(&cpus[i].sched.lock);
+        for (int j = 0; j < SCHED_RT_PRIOS; ++j)
+            init_list_node(&cpus[i].sched.rt_rq[j]);
+        bitmap_clear_range(cpus[i].sched.rt_ready, 0, SCHED_RT_PRIOS);
+        cpus[i].sched.rq.rb_node = cpus[i].sched.leftmost = NULL;
+        cpus[i].sched.load = cpus[i].sched.min_vruntime = 0;
+        cpus[i].sched.nr_ready = 0;
         Proc *p = kalloc(sizeof(Proc));
         p->idle = 1;
         p->state = RUNNING;
+        p->schinfo.cpu = i;
         cpus[i].sched.this = cpus[i].sched.idle = p;
 
         sched_timer[i].triggered = true;
         sched_timer[i].data = i;
-        sched_timer[i].elapse = 5;
+        sched_timer[i].elapse = SCHED_LATENCY;
         sched_timer[i].handler = &sched_timer_handler;
     }
 }
@@ -46,36 +68,191 @@ Proc* thisproc()
 void init_schinfo(struct schinfo *p)
 {
     // TODO: initialize your customized schinfo for every newly-created process
-    init_list_node(&p->rq);
+    // start on the CPU that creates the proc; idle CPUs steal it if needed.
+    p->cpu = cpuid();
+    init_list_node(&p->rt_rq);
+    p->rt_prio = 0;
+    p->nice = 0;
+    p->vruntime = p->start = 0;
 }
 
 void acquire_sched_lock()
 {
-    // TODO: acquire the sched_lock if need
-    acquire_spinlock(&rqlock);
+    acquire_spinlock(&cpus[cpuid()].sched.lock);
 }
 
 void release_sched_lock()
 {
-    // TODO: release the sched_lock if need
-    release_spinlock(&rqlock);
+    release_spinlock(&cpus[cpuid()].sched.lock);
+}
+
+// lock the run queue `p` belongs to. `p` may move to another CPU until
+// the lock is taken, so check again after taking it.
+static struct sched *_lock_rq(Proc *p)
+{
+    while (1) {
+        int cpu = __atomic_load_n(&p->schinfo.cpu, __ATOMIC_RELAXED);
+        struct sched *s = &cpus[cpu].sched;
+        acquire_spinlock(&s->lock);
+        if (p->schinfo.cpu == cpu)
+            return s;
+        release_spinlock(&s->lock);
+    }
+}
+
+static INLINE u64 _weight(Proc *p)
+{
+    return nice_to_weight[p->schinfo.nice - NICE_MIN];
+}
+
+static INLINE Proc *_rq_proc(rb_node node)
+{
+    return container_of(node, Proc, schinfo.rq);
+}
+
+static bool _vruntime_cmp(rb_node lnode, rb_node rnode)
+{
+    Proc *l = _rq_proc(lnode), *r = _rq_proc(rnode);
+    if (l->schinfo.vruntime != r->schinfo.vruntime)
+        return l->schinfo.vruntime < r->schinfo.vruntime;
+    // the tree rejects equal keys.
+    return l < r;
+}
+
+static INLINE usize _rt_level(Proc *p)
+{
+    return SCHED_RT_PRIOS - p->schinfo.rt_prio;
+}
+
+static void _enqueue(struct sched *s, Proc *p)
+{
+    if (p->schinfo.rt_prio) {
+        usize level = _rt_level(p);
+        _insert_into_list(s->rt_rq[level].prev, &p->schinfo.rt_rq);
+        bitmap_set(s->rt_ready, level);
+    } else {
+        ASSERT(_rb_insert(&p->schinfo.rq, &s->rq, _vruntime_cmp) == 0);
+        if (s->leftmost == NULL || _vruntime_cmp(&p->schinfo.rq, s->leftmost))
+            s->leftmost = &p->schinfo.rq;
+        s->load += _weight(p);
+    }
+    __atomic_store_n(&s->nr_ready, s->nr_ready + 1, __ATOMIC_RELAXED);
+}
+
+static void _dequeue(struct sched *s, Proc *p)
+{
+    if (p->schinfo.rt_prio) {
+        usize level = _rt_level(p);
+        _detach_from_list(&p->schinfo.rt_rq);
+        if (_empty_list(&s->rt_rq[level]))
+            bitmap_clear(s->rt_ready, level);
+    } else {
+        if (s->leftmost == &p->schinfo.rq)
+            s->leftmost = _rb_next(s->leftmost);
+        _rb_erase(&p->schinfo.rq, &s->rq);
+        s->load -= _weight(p);
+    }
+    __atomic_store_n(&s->nr_ready, s->nr_ready - 1, __ATOMIC_RELAXED);
+}
+
+// the proc to run next on `s`, without removing it. NULL if none.
+static Proc *_first_ready(struct sched *s)
+{
+    usize level = bitmap_find_next_set(s->rt_ready, SCHED_RT_PRIOS, 0);
+    if (level < SCHED_RT_PRIOS)
+        return container_of(s->rt_rq[level].next, Proc, schinfo.rt_rq);
+    return s->leftmost ? _rq_proc(s->leftmost) : NULL;
+}
+
+// charge the running proc for the time since it last started, and move
+// `min_vruntime` up to the smallest vruntime on this CPU.
+static void _account(struct sched *s)
+{
+    auto this = s->this;
+    u64 now = get_timestamp();
+    u64 min = (u64)-1;
+    // procs with a fixed priority are not charged.
+    if (this != s->idle && !this->schinfo.rt_prio) {
+        this->schinfo.vruntime +=
+            (now - this->schinfo.start) * NICE_0_WEIGHT / _weight(this);
+        min = this->schinfo.vruntime;
+    }
+    this->schinfo.start = now;
+    if (s->leftmost != NULL)
+        min = MIN(min, _rq_proc(s->leftmost)->schinfo.vruntime);
+    if (min != (u64)-1)
+        s->min_vruntime = MAX(s->min_vruntime, min);
+}
+
+// place a proc joining `s`. A new proc starts at `min_vruntime`; a sleeper
+// keeps its vruntime, but gets at most half a latency of credit for the
+// time it slept, so it runs soon without starving the others.
+static void _place(struct sched *s, Proc *p, bool new)
+{
+    if (new) {
+        p->schinfo.vruntime = s->min_vruntime;
+        return;
+    }
+    u64 credit = get_clock_frequency() * SCHED_LATENCY / 1000 / 2;
+    u64 floor = s->min_vruntime > credit ? s->min_vruntime - credit : 0;
+    p->schinfo.vruntime = MAX(p->schinfo.vruntime, floor);
+}
+
+// the time slice in ms of `p` when it starts running on `s`: its share of
+// SCHED_LATENCY by weight.
+static int _time_slice(struct sched *s, Proc *p)
+{
+    if (p == s->idle || p->schinfo.rt_prio)
+        return SCHED_LATENCY;
+    u64 w = _weight(p);
+    u64 slice = SCHED_LATENCY * w / (s->load + w);
+    return (int)MAX(slice, (u64)SCHED_MIN_SLICE);
+}
+
+void set_nice(Proc *p, int nice)
+{
+    nice = MAX(NICE_MIN, MIN(nice, NICE_MAX));
+    auto s = _lock_rq(p);
+    // the tree is ordered by vruntime, so only the load changes.
+    bool queued = p->state == RUNNABLE && p != s->idle && !p->schinfo.rt_prio;
+    if (queued)
+        s->load -= _weight(p);
+    p->schinfo.nice = nice;
+    if (queued)
+        s->load += _weight(p);
+    release_spinlock(&s->lock);
+}
+
+void set_rt_prio(Proc *p, int prio)
+{
+    prio = MAX(0, MIN(prio, SCHED_RT_PRIOS));
+    auto s = _lock_rq(p);
+    bool queued = p->state == RUNNABLE && p != s->idle;
+    if (queued)
+        _dequeue(s, p);
+    if (p->schinfo.rt_prio && !prio)
+        _place(s, p, true);
+    p->schinfo.rt_prio = prio;
+    if (queued)
+        _enqueue(s, p);
+    release_spinlock(&s->lock);
 }
 
 bool is_zombie(Proc *p)
 {
     bool r;
-    acquire_sched_lock();
+    auto s = _lock_rq(p);
     r = p->state == ZOMBIE;
-    release_sched_lock();
+    release_spinlock(&s->lock);
     return r;
 }
 
 bool is_unused(Proc *p)
 {
     bool r;
-    acquire_sched_lock();
+    auto s = _lock_rq(p);
     r = p->state == UNUSED;
-    release_sched_lock();
+    release_spinlock(&s->lock);
     return r;
 }
 
@@ -85,16 +262,19 @@ bool _activate_proc(Proc *p, bool onalert)
     // if the proc->state is RUNNING/RUNNABLE, do nothing and return false
     // if the proc->state is SLEEPING/UNUSED, set the process state to RUNNABLE, add it to the sched queue, and return true
     // if the proc->state is DEEPSLEEPING, do nothing if onalert or activate it if else, and return the corresponding value.
-    acquire_sched_lock();
+    // a woken proc goes back to the CPU it last ran on.
+    auto s = _lock_rq(p);
     if(p->state == RUNNING || p->state == RUNNABLE || p->state == ZOMBIE || (p->state == DEEPSLEEPING && onalert)) {
-        release_sched_lock();
+        release_spinlock(&s->lock);
         return false;
     }
     if(p->state == SLEEPING || p->state == UNUSED || (p->state == DEEPSLEEPING && !onalert)) {
+        if (!p->schinfo.rt_prio)
+            _place(s, p, p->state == UNUSED);
         p->state = RUNNABLE;
-        insert_into_list(&listlock, &rq, &p->schinfo.rq);
+        _enqueue(s, p);
     }
-    release_sched_lock();
+    release_spinlock(&s->lock);
     return true;
 }
 
@@ -102,46 +282,78 @@ static void update_this_state(enum procstate new_state)
 {
     // TODO: if you use template sched function, you should implement this routinue
     // update the state of current process to new_state, and modify the sched queue if necessary
-    auto this = thisproc();
-    // TODO*: The code above isn't enough. Consider a Zombie or sleeping proc.
-    if(this != cpus[cpuid()].sched.idle && (this->state == RUNNING || this->state == RUNNABLE)) {
-        detach_from_list(&listlock, &this->schinfo.rq);
-    }
+    auto s = &cpus[cpuid()].sched;
+    auto this = s->this;
+    _account(s);
     this->state = new_state;
-    if(this != cpus[cpuid()].sched.idle && (new_state == RUNNING || new_state == RUNNABLE)) {
-        insert_into_list(&listlock, rq.prev, &this->schinfo.rq);
+    if(this != s->idle && new_state == RUNNABLE) {
+        _enqueue(s, this);
     }
 }
 
+// take a proc from the run queue of a busy CPU. Called with the lock of
+// this CPU, so only try the others' locks to avoid a deadlock.
+static Proc *_steal(struct sched *s)
+{
+    int me = cpuid();
+    for (int i = 1; i < NCPU; ++i) {
+        int cpu = (me + i) % NCPU;
+        auto victim = &cpus[cpu].sched;
+        if (__atomic_load_n(&victim->nr_ready, __ATOMIC_RELAXED) == 0 ||
+            !try_acquire_spinlock(&victim->lock))
+            continue;
+        // every queued proc is RUNNABLE and has left its CPU: the CPU
+        // holds its lock until the switch away from a proc is done.
+        Proc *p = _first_ready(victim);
+        if (p != NULL && p->schinfo.rt_prio) {
+            // the highest fixed priority waits for the running proc there.
+            _dequeue(victim, p);
+        } else if (p != NULL) {
+            // the fair proc that would wait the longest there.
+            p = _rq_proc(_rb_last(&victim->rq));
+            _dequeue(victim, p);
+            // keep its distance to the front of the queue.
+            i64 lag = (i64)(p->schinfo.vruntime - victim->min_vruntime);
+            p->schinfo.vruntime = (u64)MAX((i64)s->min_vruntime + lag, 0ll);
+        }
+        if (p != NULL) {
+            p->schinfo.cpu = me;
+            _enqueue(s, p);
+        }
+        release_spinlock(&victim->lock);
+        if (p != NULL)
+            return p;
+    }
+    return NULL;
+}
+
 Proc *pick_next()
 {
     // TODO: if using template sched function, you should implement this routinue
     // choose the next process to run, and return idle if no runnable process
+    auto s = &cpus[cpuid()].sched;
     if(panic_flag) {
-        return cpus[cpuid()].sched.idle;
+        return s->idle;
     }
-    // TODO*: Dead, need improving.
-    // put it to the back.
-    _for_in_list(p, &rq) {
-        if(p == &rq) {
-            continue;
-        }
-        auto proc = container_of(p, Proc, schinfo.rq);
-        if(proc->state == RUNNABLE) {
-            detach_from_list(&listlock, p);
-            insert_into_list(&listlock, rq.prev, p);
-            return proc;
-        }
+    // the highest fixed priority, or the fair proc that has used the least
+    // CPU time.
+    auto next = _first_ready(s);
+    if(next == NULL && (next = _steal(s)) == NULL) {
+        return s->idle;
     }
-    return cpus[cpuid()].sched.idle;
-    
+    ASSERT(next->state == RUNNABLE);
+    _dequeue(s, next);
+    return next;
 }
 
 static void update_this_proc(Proc *p)
 {
     // TODO: you should implement this routinue
     // update thisproc to the choosen process
-    cpus[cpuid()].sched.this = p;
+    auto s = &cpus[cpuid()].sched;
+    s->this = p;
+    p->schinfo.start = get_timestamp();
+    sched_timer[cpuid()].elapse = _time_slice(s, p);
 
     if(!sched_timer[cpuid()].triggered) {
         cancel_cpu_timer(&sched_timer[cpuid()]);
@@ -149,15 +361,17 @@ static void update_this_proc(Proc *p)
     set_cpu_timer(&sched_timer[cpuid()]);
 }
 
-// A simple scheduler.
-// You are allowed to replace it with whatever you like.
-// call with sched_lock
+// A fair scheduler with per-CPU run queues: run the proc with the least
+// virtual runtime for a slice that shrinks as more procs are runnable.
+// call with sched_lock, i.e. the lock of this CPU
 void sched(enum procstate new_state)
 {
     auto this = thisproc();
     ASSERT(this->state == RUNNING);
+    rcu_quiescent();
     if(this->killed && new_state != ZOMBIE) {
         release_sched_lock();
+        rcu_run_callbacks();
         return;
     }
     update_this_state(new_state);
@@ -166,10 +380,17 @@ void sched(enum procstate new_state)
     ASSERT(next->state == RUNNABLE);
     next->state = RUNNING;
     if (next != this) {
+        percpu_counter_inc(&nr_switches);
         attach_pgdir(&next->pgdir);
         swtch(next->kcontext, &this->kcontext);
     }
     release_sched_lock();
+    rcu_run_callbacks();
+}
+
+isize sched_nr_switches()
+{
+    return percpu_counter_sum(&nr_switches);
 }
 
 u64 proc_entry(void (*entry)(u64), u64 arg)
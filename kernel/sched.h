@@ -19,3 +19,16 @@ void sched(enum procstate new_state);
 #define yield() (acquire_sched_lock(), sched(RUNNABLE))
 
 WARN_RESULT Proc *thisproc();
+
+#define NICE_MIN (-20)
+#define NICE_MAX 19
+// set the nice value of `p`, clamped to [NICE_MIN, NICE_MAX]. A proc with
+// nice n gets about 1.25 times the CPU time of one with nice n + 1.
+void set_nice(Proc *p, int nice);
+// give `p` a fixed priority from 1 to SCHED_RT_PRIOS, clamped. Such procs
+// always run before the fair ones, round robin within one priority. 0
+// makes `p` fair again.
+void set_rt_prio(Proc *p, int prio);
+
+// number of context switches on all CPUs so far.
+WARN_RESULT isize sched_nr_switches();
@@ -0,0 +1,264 @@
+#include <aarch64/intrinsic.h>
+#include <aarch64/mmu.h>
+#include <kernel/mem.h>
+#include <kernel/printk.h>
+#include <kernel/slab.h>
+
+// the header at the beginning of every slab page.
+struct slab {
+    ListNode node;
+    KmemCache *cache;
+    void *freelist;
+    usize inuse;
+};
+
+// the cache all `KmemCache`s created by `kmem_cache_create` come from.
+static KmemCache cache_cache;
+
+// all initialized caches, for statistics.
+static ListNode cache_list;
+static SpinLock cache_list_lock;
+
+#define NEXT(cache, obj) (*(void **)((u8 *)(obj) + (cache)->link))
+
+static INLINE struct slab *slab_of(void *obj)
+{
+    return (struct slab *)PAGE_BASE(obj);
+}
+
+static INLINE u8 *_tag_of(KmemCache *cache, void *obj)
+{
+    struct slab *s = slab_of(obj);
+    usize idx = ((u8 *)obj - (u8 *)s - cache->offset) / cache->size;
+    return (u8 *)s + cache->tags + idx;
+}
+
+void init_kmem_cache(KmemCache *cache, const char *name, usize size,
+                     usize align, u32 flags, void (*ctor)(void *))
+{
+    if (align < sizeof(void *))
+        align = sizeof(void *);
+    ASSERT((align & (align - 1)) == 0);
+    cache->name = name;
+    cache->align = align;
+    cache->flags = flags;
+    cache->ctor = ctor;
+    // a constructed object must stay intact on the free list, so put the
+    // link behind the object in that case.
+    usize size_with_link = MAX(size, sizeof(void *));
+    cache->link = 0;
+    if (ctor) {
+        cache->link = round_up(size, sizeof(void *));
+        size_with_link = cache->link + sizeof(void *);
+    }
+    cache->size = round_up(size_with_link, align);
+    cache->tags = sizeof(struct slab);
+    cache->offset = round_up(sizeof(struct slab), align);
+    ASSERT(cache->offset + cache->size <= PAGE_SIZE);
+    cache->objs_per_slab = (PAGE_SIZE - cache->offset) / cache->size;
+    if (flags & KMEM_TAGGED) {
+        // one tag byte per object between the header and the objects.
+        usize n = (PAGE_SIZE - cache->tags) / (cache->size + 1);
+        while (round_up(cache->tags + n, align) + n * cache->size > PAGE_SIZE)
+            n--;
+        ASSERT(n > 0);
+        cache->objs_per_slab = n;
+        cache->offset = round_up(cache->tags + n, align);
+    }
+
+    init_spinlock(&cache->lock);
+    init_list_node(&cache->partial);
+    init_list_node(&cache->full);
+    cache->nr_slabs = cache->nr_empty = 0;
+    for (int i = 0; i < NCPU; ++i) {
+        cache->cpu[i].freelist = NULL;
+        cache->cpu[i].count = 0;
+        cache->cpu[i].allocs = cache->cpu[i].frees = 0;
+    }
+    insert_into_list(&cache_list_lock, &cache_list, &cache->node);
+}
+
+void kmem_init()
+{
+    init_list_node(&cache_list);
+    init_spinlock(&cache_list_lock);
+    init_kmem_cache(&cache_cache, "kmem_cache", sizeof(KmemCache),
+                    CACHE_LINE_SIZE, 0, NULL);
+}
+
+KmemCache *kmem_cache_create(const char *name, usize size, usize align,
+                             u32 flags, void (*ctor)(void *))
+{
+    KmemCache *cache = kmem_cache_alloc(&cache_cache);
+    if (cache != NULL)
+        init_kmem_cache(cache, name, size, align, flags, ctor);
+    return cache;
+}
+
+// allocate a new slab and construct its objects.
+static struct slab *_new_slab(KmemCache *cache)
+{
+    struct slab *s = kalloc_page();
+    if (s == NULL)
+        return NULL;
+    init_list_node(&s->node);
+    s->cache = cache;
+    s->freelist = NULL;
+    s->inuse = 0;
+    for (usize i = cache->objs_per_slab; i-- > 0;) {
+        void *obj = (u8 *)s + cache->offset + i * cache->size;
+        if (cache->ctor)
+            cache->ctor(obj);
+        NEXT(cache, obj) = s->freelist;
+        s->freelist = obj;
+    }
+    return s;
+}
+
+// move up to KMEM_CPU_BATCH objects from the slabs to this CPU.
+static void _refill(KmemCache *cache, struct kmem_cpu_cache *cc)
+{
+    acquire_spinlock(&cache->lock);
+    while (cc->count < KMEM_CPU_BATCH) {
+        if (_empty_list(&cache->partial)) {
+            release_spinlock(&cache->lock);
+            struct slab *s = _new_slab(cache);
+            acquire_spinlock(&cache->lock);
+            if (s == NULL)
+                break;
+            cache->nr_slabs++;
+            cache->nr_empty++;
+            _insert_into_list(&cache->partial, &s->node);
+        }
+        struct slab *s = container_of(cache->partial.next, struct slab, node);
+        if (s->inuse == 0)
+            cache->nr_empty--;
+        while (s->freelist != NULL && cc->count < KMEM_CPU_BATCH) {
+            void *obj = s->freelist;
+            s->freelist = NEXT(cache, obj);
+            NEXT(cache, obj) = cc->freelist;
+            cc->freelist = obj;
+            cc->count++;
+            s->inuse++;
+        }
+        if (s->freelist == NULL) {
+            _detach_from_list(&s->node);
+            _insert_into_list(&cache->full, &s->node);
+        }
+    }
+    release_spinlock(&cache->lock);
+}
+
+// give `n` objects of this CPU back to their slabs. One empty slab is kept
+// per cache, the others are returned to the page allocator.
+static void _flush(KmemCache *cache, struct kmem_cpu_cache *cc, usize n)
+{
+    ListNode empty;
+    init_list_node(&empty);
+    acquire_spinlock(&cache->lock);
+    while (n-- > 0 && cc->freelist != NULL) {
+        void *obj = cc->freelist;
+        cc->freelist = NEXT(cache, obj);
+        cc->count--;
+        struct slab *s = slab_of(obj);
+        if (s->freelist == NULL) {
+            _detach_from_list(&s->node);
+            _insert_into_list(&cache->partial, &s->node);
+        }
+        NEXT(cache, obj) = s->freelist;
+        s->freelist = obj;
+        if (--s->inuse == 0) {
+            if (cache->nr_empty > 0) {
+                _detach_from_list(&s->node);
+                _insert_into_list(&empty, &s->node);
+                cache->nr_slabs--;
+            } else {
+                cache->nr_empty++;
+            }
+        }
+    }
+    release_spinlock(&cache->lock);
+    while (!_empty_list(&empty)) {
+        ListNode *node = empty.next;
+        _detach_from_list(node);
+        kfree_page(container_of(node, struct slab, node));
+    }
+}
+
+void *kmem_cache_alloc(KmemCache *cache)
+{
+    auto cc = &cache->cpu[cpuid()];
+    if (cc->freelist == NULL) {
+        _refill(cache, cc);
+        if (cc->freelist == NULL)
+            return NULL;
+    }
+    void *obj = cc->freelist;
+    cc->freelist = NEXT(cache, obj);
+    cc->count--;
+    cc->allocs++;
+    return obj;
+}
+
+void kmem_cache_free(KmemCache *cache, void *obj)
+{
+    if (obj == NULL)
+        return;
+    ASSERT(slab_of(obj)->cache == cache);
+    auto cc = &cache->cpu[cpuid()];
+    if (cc->count >= KMEM_CPU_LIMIT)
+        _flush(cache, cc, KMEM_CPU_BATCH);
+    NEXT(cache, obj) = cc->freelist;
+    cc->freelist = obj;
+    cc->count++;
+    cc->frees++;
+}
+
+KmemCache *kmem_cache_of(void *obj)
+{
+    return slab_of(obj)->cache;
+}
+
+void kmem_cache_set_tag(KmemCache *cache, void *obj, u8 tag)
+{
+    ASSERT(cache->flags & KMEM_TAGGED);
+    *_tag_of(cache, obj) = tag;
+}
+
+u8 kmem_cache_get_tag(KmemCache *cache, void *obj)
+{
+    ASSERT(cache->flags & KMEM_TAGGED);
+    return *_tag_of(cache, obj);
+}
+
+void kmem_cache_stat(KmemCache *cache, struct kmem_cache_stat *stat)
+{
+    stat->allocs = stat->frees = 0;
+    for (int i = 0; i < NCPU; ++i) {
+        stat->allocs += __atomic_load_n(&cache->cpu[i].allocs, __ATOMIC_RELAXED);
+        stat->frees += __atomic_load_n(&cache->cpu[i].frees, __ATOMIC_RELAXED);
+    }
+    stat->live = stat->allocs - stat->frees;
+    stat->slabs = __atomic_load_n(&cache->nr_slabs, __ATOMIC_RELAXED);
+}
+
+void kmem_dump_stats()
+{
+    printk("cache: size live allocs frees slabs use%%\n");
+    acquire_spinlock(&cache_list_lock);
+    _for_in_list(node, &cache_list) {
+        if (node == &cache_list)
+            continue;
+        KmemCache *cache = container_of(node, KmemCache, node);
+        struct kmem_cache_stat stat;
+        kmem_cache_stat(cache, &stat);
+        if (stat.allocs == 0)
+            continue;
+        usize use = stat.slabs ? stat.live * cache->size * 100 /
+                                         (stat.slabs * PAGE_SIZE)
+                               : 0;
+        printk("%s: %llu %llu %llu %llu %llu %llu%%\n", cache->name,
+               cache->size, stat.live, stat.allocs, stat.frees, stat.slabs, use);
+    }
+    release_spinlock(&cache_list_lock);
+}
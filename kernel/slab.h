@@ -0,0 +1,91 @@
+#pragma once
+
+#include <common/defines.h>
+#include <common/list.h>
+#include <common/spinlock.h>
+#include <kernel/cpu.h>
+
+// max number of free objects a CPU keeps for one cache.
+#define KMEM_CPU_LIMIT 32
+// number of objects moved between a CPU and the slabs at once.
+#define KMEM_CPU_BATCH (KMEM_CPU_LIMIT / 2)
+
+// free objects cached by one CPU, linked through the objects themselves.
+struct kmem_cpu_cache {
+    void *freelist;
+    usize count;
+    // number of objects allocated and freed on this CPU.
+    u64 allocs, frees;
+} CACHE_ALIGNED;
+
+// keep a one-byte tag for every object, see `kmem_cache_set_tag`.
+#define KMEM_TAGGED BIT(0)
+
+/**
+ * An object cache (slab allocator) for objects of one fixed size.
+ *
+ * Every slab is one page: a `struct slab` header at the beginning of the
+ * page, the object tags of a `KMEM_TAGGED` cache, and `objs_per_slab`
+ * objects. `kfree`-style lookups find the
+ * slab of an object by rounding the object address down to its page.
+ *
+ * Allocation and free first go to the per-CPU free list without any lock.
+ * `lock` is taken only to move a batch of objects between the per-CPU list
+ * and the slabs.
+ */
+typedef struct kmem_cache {
+    const char *name;
+    // object size, rounded up to `align`.
+    usize size;
+    usize align;
+    u32 flags;
+    // offset of the free list link inside a free object.
+    usize link;
+    // offset of the tag array and of the first object inside a slab.
+    usize tags, offset;
+    usize objs_per_slab;
+    // called once for every object when its slab is created. Objects must be
+    // returned to the cache in the constructed state.
+    void (*ctor)(void *);
+
+    SpinLock lock;
+    // slabs with free objects, and slabs without.
+    ListNode partial, full;
+    usize nr_slabs, nr_empty;
+    // in the list of all caches.
+    ListNode node;
+
+    struct kmem_cpu_cache cpu[NCPU];
+} KmemCache;
+
+// the largest object a single-page slab can hold.
+#define KMEM_MAX_SIZE 2016
+
+// initialize the slab allocator. Called by `kinit`.
+void kmem_init();
+
+void init_kmem_cache(KmemCache *cache, const char *name, usize size,
+                     usize align, u32 flags, void (*ctor)(void *));
+WARN_RESULT KmemCache *kmem_cache_create(const char *name, usize size,
+                                         usize align, u32 flags,
+                                         void (*ctor)(void *));
+
+WARN_RESULT void *kmem_cache_alloc(KmemCache *cache);
+void kmem_cache_free(KmemCache *cache, void *obj);
+
+// return the cache `obj` was allocated from.
+WARN_RESULT KmemCache *kmem_cache_of(void *obj);
+
+// the tag of an object in a `KMEM_TAGGED` cache. The allocator does not
+// interpret it; `kalloc` stores the allocation site there.
+void kmem_cache_set_tag(KmemCache *cache, void *obj, u8 tag);
+WARN_RESULT u8 kmem_cache_get_tag(KmemCache *cache, void *obj);
+
+struct kmem_cache_stat {
+    u64 allocs, frees;
+    // objects in use, and slab pages holding them.
+    usize live, slabs;
+};
+void kmem_cache_stat(KmemCache *cache, struct kmem_cache_stat *stat);
+// print the statistics of all caches.
+void kmem_dump_stats();
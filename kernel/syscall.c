@@ -4,6 +4,7 @@
 #include <common/sem.h>
 #include <test/test.h>
 #include <aarch64/intrinsic.h>
+#include <kernel/mem.h>
 #include <kernel/paging.h>
 
 #pragma GCC diagnostic push
@@ -57,13 +58,29 @@ bool user_readable(const void *start, usize size) {
  */
 bool user_writeable(const void *start, usize size) {
     /* (Final) TODO Begin */
+    bool ok = true, broken = false;
     for (u64 i = (u64)start; i < (u64)start + size; i = (i / BLOCK_SIZE + 1) * BLOCK_SIZE){
         auto pte = get_pte(&thisproc()->pgdir, i, false);
-        if (pte == NULL || ((*pte) & PTE_RO)) {
-            return false;
+        if (pte == NULL) {
+            ok = false;
+            break;
+        }
+        if ((*pte) & PTE_RO) {
+            // the kernel cannot write through a copy-on-write mapping
+            // either, so copy the page now like a write fault would.
+            if (!page_test_flag(virt_to_page((void*)P2K(PTE_ADDRESS(*pte))), PG_COW)
+                || !cow_break(pte)) {
+                ok = false;
+                break;
+            }
+            broken = true;
         }
     }
-    return true;
+    // pages copied before a failure stay private, so flush them either way.
+    if (broken) {
+        arch_tlbi_vmalle1is();
+    }
+    return ok;
     /* (Final) TODO End */
 }
 
@@ -5,10 +5,15 @@
 #define SYS_yield 124
 #define SYS_myreport 499
 #define SYS_pstat 500
+#define SYS_memstat 501
+#define SYS_lockstat 502
+#define SYS_schedstat 503
+#define SYS_setrtprio 504
 #define SYS_sbrk 12
 #define SYS_brk 214
 #define SYS_mprotect 226
 #define SYS_getpid 172
+#define SYS_setpriority 140
 
 #define SYS_clone 220
 #define SYS_myexit 457
@@ -1,3 +1,4 @@
+#include <common/lockstat.h>
 #include <kernel/mem.h>
 #include <kernel/paging.h>
 #include <kernel/printk.h>
@@ -28,6 +29,31 @@ define_syscall(yield) {
 
 define_syscall(pstat) { return (u64)left_page_cnt(); }
 
+define_syscall(memstat) {
+    kalloc_dump_stats();
+    return (u64)left_page_cnt();
+}
+
+// print the `n` locks with the most waiting time.
+define_syscall(lockstat, int n) {
+    lockstat_dump(n > 0 ? n : 0);
+    return 0;
+}
+
+// only PRIO_PROCESS (0) is supported.
+define_syscall(setpriority, int which, int who, int prio) {
+    if (which != 0)
+        return -1;
+    return setpriority(who, prio);
+}
+
+// give the proc `pid` a fixed priority from 1 to SCHED_RT_PRIOS, or make
+// it fair again with 0.
+define_syscall(setrtprio, int pid, int prio) { return setrtprio(pid, prio); }
+
+// number of context switches so far.
+define_syscall(schedstat) { return (u64)sched_nr_switches(); }
+
 define_syscall(sbrk, i64 size) { return sbrk(size); }
 
 define_syscall(clone, int flag, void *childstk) {
@@ -0,0 +1,122 @@
+#include <aarch64/intrinsic.h>
+#include <aarch64/mmu.h>
+#include <common/bitmap.h>
+#include <common/spinlock.h>
+#include <kernel/mem.h>
+#include <kernel/pt.h>
+
+/**
+ * `kvalloc` maps scattered physical pages into the kernel virtual range
+ * [VMALLOC_START, VMALLOC_START + VMALLOC_SIZE), which lives in its own
+ * level-0 entry of `kernel_pt_level0`.
+ *
+ * Every allocation is followed by an unmapped guard page, so an overrun
+ * faults instead of corrupting the next allocation.
+ *
+ * Everything here is protected by `vmalloc_lock`.
+ */
+#define VMALLOC_PAGES (VMALLOC_SIZE / PAGE_SIZE)
+
+static SpinLock vmalloc_lock;
+// wraps `kernel_pt_level0` so that we can use `get_pte`.
+static struct pgdir kernel_pgdir;
+// pages of the range taken by an allocation, including its guard page.
+static Bitmap(vm_used, VMALLOC_PAGES);
+// the guard page that ends every allocation.
+static Bitmap(vm_end, VMALLOC_PAGES);
+// where the next search starts.
+static usize vm_hint;
+
+void init_vmalloc() {
+    extern PTEntries kernel_pt_level0;
+    init_spinlock(&vmalloc_lock);
+    kernel_pgdir.pt = kernel_pt_level0;
+}
+
+// find `n` free pages in a row, starting the search at `vm_hint` and
+// wrapping around once. A run cannot wrap around the end of the range.
+static isize _vm_find(usize n) {
+    for (int pass = 0; pass < 2; ++pass) {
+        usize i = pass == 0 ? vm_hint : 0;
+        while ((i = bitmap_find_next_zero(vm_used, VMALLOC_PAGES, i)) <
+               VMALLOC_PAGES) {
+            usize end = bitmap_find_next_set(vm_used, VMALLOC_PAGES, i);
+            if (end - i >= n)
+                return i;
+            i = end;
+        }
+    }
+    return -1;
+}
+
+static u64 _vm_addr(usize idx) {
+    return VMALLOC_START + idx * PAGE_SIZE;
+}
+
+// unmap and free the pages of the allocation starting at `idx`. Call with
+// `vmalloc_lock`.
+static void _vm_release(usize idx) {
+    usize end = bitmap_find_next_set(vm_end, VMALLOC_PAGES, idx);
+    ASSERT(end < VMALLOC_PAGES);
+    for (usize i = idx; i < end; ++i) {
+        auto pte = get_pte(&kernel_pgdir, _vm_addr(i), false);
+        if (pte != NULL)
+            *pte &= ~(u64)PTE_VALID;
+    }
+    // no CPU may use the pages any more before they are freed.
+    arch_tlbi_vmalle1is();
+    for (usize i = idx; i < end; ++i) {
+        auto pte = get_pte(&kernel_pgdir, _vm_addr(i), false);
+        if (pte != NULL && *pte != 0) {
+            kfree_page((void *)P2K(PTE_ADDRESS(*pte)));
+            *pte = 0;
+        }
+    }
+    bitmap_clear(vm_end, end);
+    bitmap_clear_range(vm_used, idx, end + 1 - idx);
+}
+
+void *kvalloc(usize size) {
+    usize n = round_up(size, PAGE_SIZE) / PAGE_SIZE;
+    if (n == 0 || n >= VMALLOC_PAGES)
+        return NULL;
+    acquire_spinlock(&vmalloc_lock);
+    isize idx = _vm_find(n + 1);
+    if (idx < 0) {
+        release_spinlock(&vmalloc_lock);
+        return NULL;
+    }
+    bitmap_set_range(vm_used, idx, n + 1);
+    bitmap_set(vm_end, idx + n);
+    vm_hint = (idx + n + 1) % VMALLOC_PAGES;
+
+    for (usize i = idx; i < idx + n; ++i) {
+        void *page = kalloc_zeroed_page();
+        auto pte = page ? get_pte(&kernel_pgdir, _vm_addr(i), true) : NULL;
+        if (pte == NULL) {
+            kfree_page(page);
+            _vm_release(idx);
+            release_spinlock(&vmalloc_lock);
+            return NULL;
+        }
+        *pte = K2P(page) | PTE_KERNEL_PAGE;
+    }
+    release_spinlock(&vmalloc_lock);
+    // make the new entries visible to the table walker before they are used.
+    arch_fence();
+    arch_isb();
+    return (void *)_vm_addr(idx);
+}
+
+void kvfree(void *p) {
+    if (p == NULL)
+        return;
+    u64 addr = (u64)p;
+    ASSERT(addr >= VMALLOC_START && addr < VMALLOC_START + VMALLOC_SIZE);
+    ASSERT(addr % PAGE_SIZE == 0);
+    usize idx = (addr - VMALLOC_START) / PAGE_SIZE;
+    acquire_spinlock(&vmalloc_lock);
+    ASSERT(bitmap_get(vm_used, idx) && !bitmap_get(vm_end, idx));
+    _vm_release(idx);
+    release_spinlock(&vmalloc_lock);
+}
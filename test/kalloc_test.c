@@ -6,11 +6,13 @@
 #include <kernel/printk.h>
 #include <test/test.h>
 
-extern RefCount kalloc_page_cnt;
-
 static RefCount x;
 static void *p[4][10000];
 static short sz[4][10000];
+static u64 cycles[4];
+
+#define THROUGHPUT_ROUNDS 200
+#define THROUGHPUT_BURST 256
 
 #define FAIL(...)            \
     {                        \
@@ -23,9 +25,31 @@ static short sz[4][10000];
     while (x.count < 4 * i); \
     arch_dsb_sy();
 
+// the size mix of kernel objects.
+static int random_size() {
+    int z = 0;
+    int r = rand() & 255;
+    if (r < 127) {  // [17,64]
+        z = rand() % 48 + 17;
+        z = round_up((u64)z, 4ll);
+    } else if (r < 181) {  // [1,16]
+        z = rand() % 16 + 1;
+    } else if (r < 235) {  // [65,256]
+        z = rand() % 192 + 65;
+        z = round_up((u64)z, 8ll);
+    } else if (r < 255) {  // [257,512]
+        z = rand() % 256 + 257;
+        z = round_up((u64)z, 8ll);
+    } else {  // [513,2040]
+        z = rand() % 1528 + 513;
+        z = round_up((u64)z, 8ll);
+    }
+    return z;
+}
+
 void kalloc_test() {
     int i = cpuid();
-    int r = kalloc_page_cnt.count;
+    int r = kalloc_page_count();
     int y = 10000 - i * 500;
     if (i == 0)
         printk("\n\nkalloc_test\n");
@@ -44,28 +68,12 @@ void kalloc_test() {
         kfree_page(p[i][j]);
     }
     SYNC(2)
-    if (kalloc_page_cnt.count != r)
-        FAIL("FAIL: kalloc_page_cnt %d -> %lld\n", r, kalloc_page_cnt.count);
+    if (kalloc_page_count() != r)
+        FAIL("FAIL: kalloc_page_cnt %d -> %lld\n", r, kalloc_page_count());
     SYNC(3)
     for (int j = 0; j < 10000;) {
         if (j < 1000 || rand() > RAND_MAX / 16 * 7) {
-            int z = 0;
-            int r = rand() & 255;
-            if (r < 127) {  // [17,64]
-                z = rand() % 48 + 17;
-                z = round_up((u64)z, 4ll);
-            } else if (r < 181) {  // [1,16]
-                z = rand() % 16 + 1;
-            } else if (r < 235) {  // [65,256]
-                z = rand() % 192 + 65;
-                z = round_up((u64)z, 8ll);
-            } else if (r < 255) {  // [257,512]
-                z = rand() % 256 + 257;
-                z = round_up((u64)z, 8ll);
-            } else {  // [513,2040]
-                z = rand() % 1528 + 513;
-                z = round_up((u64)z, 8ll);
-            }
+            int z = random_size();
             sz[i][j] = z;
             p[i][j] = kalloc(z);
             u64 q = (u64)p[i][j];
@@ -94,12 +102,155 @@ void kalloc_test() {
         for (int j = 0; j < 4; j++)
             for (int k = 0; k < 10000; k++)
                 z += sz[j][k];
-        printk("Total: %lld\nUsage: %lld\n", z, kalloc_page_cnt.count - r);
+        printk("Total: %lld\nUsage: %lld\n", z, kalloc_page_count() - r);
     }
     SYNC(5)
     for (int j = 0; j < 10000; j++)
         kfree(p[i][j]);
     SYNC(6)
+    // contended throughput: every CPU allocates and frees bursts larger than
+    // its magazine, so pages keep moving through the shared free list.
+    u64 t0 = get_timestamp();
+    for (int round = 0; round < THROUGHPUT_ROUNDS; round++) {
+        for (int j = 0; j < THROUGHPUT_BURST; j++)
+            if ((p[i][j] = kalloc_page()) == NULL)
+                FAIL("FAIL: kalloc_page() out of memory\n");
+        for (int j = 0; j < THROUGHPUT_BURST; j++)
+            kfree_page(p[i][j]);
+    }
+    cycles[i] = get_timestamp() - t0;
+    SYNC(7)
+    if (cpuid() == 0) {
+        u64 ops = 2ull * THROUGHPUT_ROUNDS * THROUGHPUT_BURST, freq = get_clock_frequency();
+        for (int j = 0; j < 4; j++)
+            printk("CPU %d: %lld page ops/ms\n", j,
+                   ops * freq / 1000 / MAX(cycles[j], 1ull));
+    }
+    SYNC(8)
     if (cpuid() == 0)
         printk("kalloc_test PASS\n");
 }
+
+/**
+ * Allocator benchmark. Every workload runs on 1, 2 and 4 CPUs at once. For
+ * every operation we record its latency in `get_timestamp()` ticks in a
+ * log2 histogram, and print throughput and tail latency per workload.
+ */
+#define BENCH_OPS 20000
+#define BENCH_BURST 64
+#define BENCH_LIVE 1000
+#define BENCH_BUCKETS 32
+
+static RefCount bench_barrier;
+static u64 hist[4][BENCH_BUCKETS];
+static u64 max_lat[4];
+
+#define BENCH_SYNC(i)                         \
+    arch_dsb_sy();                            \
+    increment_rc(&bench_barrier);             \
+    while (bench_barrier.count < 4 * (i));    \
+    arch_dsb_sy();
+
+static INLINE void record(int cpu, u64 t) {
+    int b = t ? 64 - __builtin_clzll(t) : 0;
+    hist[cpu][MIN(b, BENCH_BUCKETS - 1)]++;
+    max_lat[cpu] = MAX(max_lat[cpu], t);
+}
+
+// alloc and free bursts of pages.
+static void bench_pages(int cpu) {
+    for (int n = 0; n < BENCH_OPS; n += 2 * BENCH_BURST) {
+        for (int j = 0; j < BENCH_BURST; j++) {
+            u64 t = get_timestamp();
+            p[cpu][j] = kalloc_page();
+            record(cpu, get_timestamp() - t);
+            if (p[cpu][j] == NULL)
+                FAIL("FAIL: kalloc_page() out of memory\n");
+        }
+        for (int j = 0; j < BENCH_BURST; j++) {
+            u64 t = get_timestamp();
+            kfree_page(p[cpu][j]);
+            record(cpu, get_timestamp() - t);
+        }
+    }
+}
+
+// random kalloc/kfree with the size mix of `kalloc_test`, keeping up to
+// BENCH_LIVE objects alive.
+static void bench_kalloc(int cpu) {
+    int live = 0;
+    for (int n = 0; n < BENCH_OPS; n++) {
+        u64 t;
+        if (live == 0 || (live < BENCH_LIVE && (rand() & 1))) {
+            int z = random_size();
+            t = get_timestamp();
+            p[cpu][live] = kalloc(z);
+            record(cpu, get_timestamp() - t);
+            if (p[cpu][live++] == NULL)
+                FAIL("FAIL: kalloc(%d) out of memory\n", z);
+        } else {
+            int k = rand() % live;
+            t = get_timestamp();
+            kfree(p[cpu][k]);
+            record(cpu, get_timestamp() - t);
+            p[cpu][k] = p[cpu][--live];
+        }
+    }
+    while (live > 0)
+        kfree(p[cpu][--live]);
+}
+
+// the upper bound of the bucket holding the `permille`-th latency.
+static u64 percentile(u64 *h, u64 total, u64 permille) {
+    u64 seen = 0;
+    for (int b = 0; b < BENCH_BUCKETS; b++) {
+        seen += h[b];
+        if (seen * 1000 >= total * permille)
+            return BIT(b);
+    }
+    return BIT(BENCH_BUCKETS - 1);
+}
+
+static void bench_report(const char *name, int ncpu) {
+    u64 h[BENCH_BUCKETS] = {0}, total = 0, max = 0, ticks = 0;
+    for (int c = 0; c < ncpu; c++) {
+        for (int b = 0; b < BENCH_BUCKETS; b++) {
+            h[b] += hist[c][b];
+            total += hist[c][b];
+        }
+        max = MAX(max, max_lat[c]);
+        ticks = MAX(ticks, cycles[c]);
+    }
+    printk("%s\t%d\t%llu\t%llu\t%llu\t%llu\t%llu\n", name, ncpu,
+           total * get_clock_frequency() / MAX(ticks, 1ull),
+           percentile(h, total, 500), percentile(h, total, 990),
+           percentile(h, total, 999), max);
+}
+
+void kalloc_bench() {
+    int i = cpuid(), round = 0;
+    void (*workload[])(int) = {bench_pages, bench_kalloc};
+    const char *name[] = {"page", "kalloc"};
+    if (i == 0)
+        printk("\n\nkalloc_bench\nworkload\tcpus\tops/s\tp50\tp99\tp99.9\tmax\n");
+    for (int w = 0; w < 2; w++) {
+        for (int ncpu = 1; ncpu <= 4; ncpu *= 2) {
+            for (int b = 0; b < BENCH_BUCKETS; b++)
+                hist[i][b] = 0;
+            max_lat[i] = cycles[i] = 0;
+            BENCH_SYNC(++round)
+            if (i < ncpu) {
+                u64 t0 = get_timestamp();
+                workload[w](i);
+                cycles[i] = get_timestamp() - t0;
+            }
+            BENCH_SYNC(++round)
+            if (i == 0)
+                bench_report(name[w], ncpu);
+            // keep the counters until they are reported.
+            BENCH_SYNC(++round)
+        }
+    }
+    if (i == 0)
+        printk("kalloc_bench PASS\n");
+}
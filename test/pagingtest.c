@@ -110,4 +110,57 @@ void pgfault_second_test() {
     if (!check_zero_page())
         PANIC();
     printk("pgfault_second_test PASS!\n");
-}
\ No newline at end of file
+}
+// `vm_copy` shares the heap pages read-only: the first write of the parent
+// copies each page, and the child is then the last user of the original
+// and takes it over without another copy.
+void pgfault_cow_test() {
+    i64 limit = 10;
+    struct pgdir *pd = &thisproc()->pgdir;
+    ASSERT(pd->pt);
+    attach_pgdir(pd);
+    sbrk(limit * PAGE_SIZE);
+    for (i64 i = 0; i < limit; ++i) {
+        u64 va = (u64)i * PAGE_SIZE;
+        *(i64 *)va = i;
+    }
+    struct pgdir *child = vm_copy(pd);
+    ASSERT(child);
+    u64 pc = left_page_cnt();
+
+    // the parent writes.
+    printk("in COW fork\n");
+    for (i64 i = 0; i < limit; ++i) {
+        u64 va = (u64)i * PAGE_SIZE;
+        ASSERT(*(i64 *)va == i);
+        *(i64 *)va = i + limit;
+    }
+    ASSERT(left_page_cnt() == pc - limit);
+
+    // the child writes, as its write fault would.
+    for (i64 i = 0; i < limit; ++i) {
+        auto pte = get_pte(child, (u64)i * PAGE_SIZE, false);
+        ASSERT(pte && (*pte & PTE_RO));
+        i64 *page = (i64 *)P2K(PTE_ADDRESS(*pte));
+        ASSERT(*page == i);
+        bool ok = cow_break(pte);
+        ASSERT(ok);
+        ASSERT(!(*pte & PTE_RO) && (i64 *)P2K(PTE_ADDRESS(*pte)) == page);
+        ASSERT(!page_test_flag(virt_to_page(page), PG_COW));
+        *page = -i;
+    }
+    ASSERT(left_page_cnt() == pc - limit);
+    for (i64 i = 0; i < limit; ++i) {
+        u64 va = (u64)i * PAGE_SIZE;
+        ASSERT(*(i64 *)va == i + limit);
+    }
+
+    for (i64 i = 0; i < limit; ++i) {
+        auto pte = get_pte(child, (u64)i * PAGE_SIZE, false);
+        kfree_page((void *)P2K(PTE_ADDRESS(*pte)));
+    }
+    free_pgdir(child);
+    kfree(child);
+    sbrk(-limit * PAGE_SIZE);
+    printk("pgfault_cow_test PASS!\n");
+}
@@ -3,6 +3,7 @@
 #include "common/rc.h"
 #include "common/spinlock.h"
 #include "test.h"
+#include <kernel/mem.h>
 #include <kernel/printk.h>
 struct mytype {
     struct rb_node_ node;
@@ -25,6 +26,85 @@ static SpinLock lock;
     }
 static RefCount x;
 
+// an interval tree: every node keeps the max end of its subtree.
+struct interval {
+    struct rb_node_ node;
+    int start, end, max_end;
+};
+static struct interval iv[1000];
+
+static int _max_end(rb_node n)
+{
+    return n ? container_of(n, struct interval, node)->max_end : -1;
+}
+static bool iv_update(rb_node n)
+{
+    struct interval *v = container_of(n, struct interval, node);
+    int m = MAX(v->end, MAX(_max_end(n->rb_left), _max_end(n->rb_right)));
+    if (m == v->max_end)
+        return false;
+    v->max_end = m;
+    return true;
+}
+static const struct rb_augment iv_augment = { .update = iv_update };
+static bool iv_cmp(rb_node n1, rb_node n2)
+{
+    return container_of(n1, struct interval, node)->start <
+           container_of(n2, struct interval, node)->start;
+}
+// check the max ends of the whole subtree, and return its max end.
+static int iv_check(rb_node n)
+{
+    if (n == NULL)
+        return -1;
+    struct interval *v = container_of(n, struct interval, node);
+    int m = MAX(v->end, MAX(iv_check(n->rb_left), iv_check(n->rb_right)));
+    if (m != v->max_end)
+        FAIL("augment error! %d %d %d\n", v->start, v->max_end, m);
+    return m;
+}
+
+static void order_test()
+{
+    int n = 0, last = -1;
+    for (rb_node np = _rb_first(&rt); np; np = _rb_next(np), n++) {
+        int key = container_of(np, struct mytype, node)->key;
+        if (key <= last)
+            FAIL("next out of order! %d %d\n", last, key);
+        last = key;
+    }
+    if (n != 4000)
+        FAIL("next visited %d nodes\n", n);
+    for (rb_node np = _rb_last(&rt); np; np = _rb_prev(np), n--) {
+        int key = container_of(np, struct mytype, node)->key;
+        if (key > last)
+            FAIL("prev out of order! %d %d\n", last, key);
+        last = key;
+    }
+    if (n != 0)
+        FAIL("prev missed %d nodes\n", n);
+}
+
+static void augment_test()
+{
+    struct rb_root_ root = { NULL };
+    for (int i = 0; i < 1000; i++) {
+        iv[i].start = (i * 7919) % 1000;
+        iv[i].end = iv[i].start + rand() % 1000;
+        iv[i].max_end = -1;
+        if (_rb_insert_augmented(&iv[i].node, &root, iv_cmp, &iv_augment))
+            FAIL("augmented insert failed!\n");
+    }
+    iv_check(root.rb_node);
+    for (int i = 0; i < 1000; i += 2)
+        _rb_erase_augmented(&iv[i].node, &root, &iv_augment);
+    iv_check(root.rb_node);
+    for (int i = 1; i < 1000; i += 2)
+        _rb_erase_augmented(&iv[i].node, &root, &iv_augment);
+    if (root.rb_node != NULL)
+        FAIL("augmented tree not empty!\n");
+}
+
 void rbtree_test()
 {
     int cid = cpuid();
@@ -64,6 +144,61 @@ void rbtree_test()
     while (x.count < 8)
         ;
     arch_dsb_sy();
-    if (cid == 0)
+    if (cid == 0) {
+        order_test();
+        augment_test();
         printk("rbtree_test PASS\n");
+    }
+}
+
+#define BENCH_NODES 100000
+
+static u64 bench_rate(u64 ticks)
+{
+    return (u64)BENCH_NODES * get_clock_frequency() / MAX(ticks, 1ull);
+}
+
+// single-CPU throughput of insert, lookup and erase at BENCH_NODES nodes.
+void rbtree_bench()
+{
+    if (cpuid() != 0)
+        return;
+    struct mytype *nodes = kvalloc(BENCH_NODES * sizeof(struct mytype));
+    if (nodes == NULL)
+        FAIL("FAIL: kvalloc out of memory\n");
+    struct rb_root_ root = { NULL };
+    // 7919 is prime, so the keys are a permutation of [0, BENCH_NODES).
+    for (int i = 0; i < BENCH_NODES; i++)
+        nodes[i].key = nodes[i].data = (int)((i * 7919ll) % BENCH_NODES);
+
+    u64 t = get_timestamp();
+    for (int i = 0; i < BENCH_NODES; i++) {
+        if (_rb_insert(&nodes[i].node, &root, rb_cmp))
+            FAIL("insert failed!\n");
+    }
+    u64 insert = get_timestamp() - t;
+
+    struct mytype key;
+    t = get_timestamp();
+    for (int i = 0; i < BENCH_NODES; i++) {
+        key.key = i;
+        rb_node np = _rb_lookup(&key.node, &root, rb_cmp);
+        if (np == NULL || container_of(np, struct mytype, node)->data != i)
+            FAIL("lookup failed! %d\n", i);
+    }
+    u64 lookup = get_timestamp() - t;
+
+    t = get_timestamp();
+    for (int i = 0; i < BENCH_NODES; i++)
+        _rb_erase(&nodes[i].node, &root);
+    u64 erase = get_timestamp() - t;
+    if (root.rb_node != NULL)
+        FAIL("tree not empty!\n");
+    kvfree(nodes);
+
+    printk("\n\nrbtree_bench\nop\tnodes\tops/s\n");
+    printk("insert\t%d\t%llu\n", BENCH_NODES, bench_rate(insert));
+    printk("lookup\t%d\t%llu\n", BENCH_NODES, bench_rate(lookup));
+    printk("erase\t%d\t%llu\n", BENCH_NODES, bench_rate(erase));
+    printk("rbtree_bench PASS\n");
 }
\ No newline at end of file
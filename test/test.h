@@ -3,8 +3,14 @@
 
 #define RAND_MAX 32768
 
+// kalloc_test and kalloc_bench run on all four CPUs at once: call them on
+// every CPU from the boot path, right after `kinit`. They print page
+// throughput and kalloc latencies; build once more with -DPAGE_DEPOT=0
+// for the numbers of the locked page pool.
 void kalloc_test();
+void kalloc_bench();
 void rbtree_test();
+void rbtree_bench();
 void proc_test();
 void vm_test();
 void user_proc_test();
@@ -15,4 +21,5 @@ void srand(unsigned seed);
 // syscall
 u64 syscall_myreport(u64 id);
 void pgfault_first_test();
-void pgfault_second_test();
\ No newline at end of file
+void pgfault_second_test();
+void pgfault_cow_test();
\ No newline at end of file